@@ -1,3 +1,7 @@
+// Building and sending LED_STRIP_CONFIG messages. No UI and no global state,
+// so the GUI, the CLI and other tools can all share it.
+#pragma once
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <mavsdk/mavsdk.h>
@@ -20,12 +24,19 @@
 #define PINK 0x00FF007F
 #define WHITE 0x00FFFFFF
 
+// Default LED component address
+#define LED_TARGET_SYSTEM 1
+#define LED_TARGET_COMPONENT 134
+
 extern uint32_t ArrayOfColours[];
 extern uint8_t NoOfColours;
-extern mavlink_led_strip_config_t LEDStripConfig;
+
+// Fill every strip, addressed to the given LED component
+mavlink_led_strip_config_t makeLEDStripConfig(uint8_t target_system = LED_TARGET_SYSTEM,
+                                              uint8_t target_component = LED_TARGET_COMPONENT);
 
 void setFollowFlightMode(mavlink_led_strip_config_t &);
 void setLEDFillColour(uint32_t, mavlink_led_strip_config_t &);
-void cycleLEDColour(mavsdk::MavlinkPassthrough &, const mavlink_led_strip_config_t &);
+uint32_t cycleLEDColour(void);
 void sendLedStripConfig(mavsdk::MavlinkPassthrough &, const mavlink_led_strip_config_t &);
 
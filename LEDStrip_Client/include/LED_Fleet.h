@@ -0,0 +1,59 @@
+// Fleet mode: one operator station driving many vehicles at once.
+//
+// Listens on a local UDP port the way a GCS does. Every autopilot HEARTBEAT
+// seen there adds (or refreshes) a vehicle at the address it came from.
+// send() encodes the command once per vehicle, each copy addressed to that
+// vehicle's LED component, into a frame buffer the vehicle owns, and hands
+// the whole fleet to the kernel in a single sendmmsg. Fan-out time therefore
+// grows with the encode cost per vehicle, not with syscalls or threads.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#define FLEET_MAX_VEHICLES 255
+#define FLEET_TARGET_SYSTEM_OFFSET 32   // In the LED_STRIP_CONFIG payload, after colors[8]
+
+class LEDFleet
+{
+public:
+    // sysid/compid identify us; vehicles are addressed at LED_TARGET_COMPONENT.
+    LEDFleet(uint16_t port, uint8_t sysid = 1, uint8_t compid = 135);
+    ~LEDFleet();
+
+    bool ok(void) const { return fd >= 0; }
+    size_t size(void);
+
+    // Sends config to every vehicle found so far, with target_system and
+    // target_component filled in per vehicle. Returns how many were sent.
+    size_t send(const mavlink_led_strip_config_t &config);
+
+private:
+    struct Vehicle {
+        uint8_t sysid;
+        struct sockaddr_storage address;
+        socklen_t addressLen;
+        uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+    };
+
+    void receive(void);
+    void heard(uint8_t sysid, const struct sockaddr_storage &address, socklen_t addressLen);
+
+    int fd;
+    uint8_t sysid;
+    uint8_t compid;
+
+    std::mutex lock;
+    std::vector<Vehicle> vehicles;      // Reserved up front; never reallocates
+    std::vector<struct mmsghdr> batch;
+    std::vector<struct iovec> iov;
+
+    std::atomic<bool> running{true};
+    std::thread thread;
+};
@@ -0,0 +1,146 @@
+// Sends LED_STRIP_CONFIG states from a dedicated thread so the UI never
+// waits on the MAVLink link.
+//
+// The UI posts each new state into a single-slot, latest-wins mailbox and
+// carries on. The sender thread transmits only the newest state, at most
+// maxRateHz times a second; states overwritten before it got to them are
+// never sent.
+//
+// On slow links a LinkBudget also holds LED traffic to a share of the link
+// rate, so it never crowds out heartbeats and telemetry. Urgent states (mode
+// changes) have their own mailbox and go first; a normal state that is older
+// than what was last sent is dropped rather than sent out of order.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#define LED_SEND_MAX_RATE_HZ 20.0
+#define LED_LINK_SHARE 0.1              // Of the link rate, for LED traffic
+#define LED_BUDGET_BURST_S 0.5          // Bucket depth, in seconds of budget
+#define LED_RADIO_TXBUF_LOW 25          // RADIO_STATUS txbuf (% free) to back off at
+#define LED_RADIO_TXBUF_HIGH 50         // ...and to recover above
+#define LED_RADIO_MIN_SCALE 0.125
+
+// Bytes per second of a serial:// URL (8N1, so baud / 10); 0 for anything
+// else, meaning no limit.
+double linkBytesPerSecond(const std::string &url);
+
+// Token bucket over bytes on the wire. Refills at share of the link rate,
+// scaled down multiplicatively while the radio reports its transmit buffer
+// filling, and back up additively once it drains.
+class LinkBudget
+{
+public:
+    explicit LinkBudget(double linkBytesPerSecond = 0, double share = LED_LINK_SHARE);
+
+    bool limited(void) const { return rate > 0; }
+    double bytesPerSecond(void) const { return rate * scale.load(std::memory_order_relaxed); }
+
+    // Sender thread. The budget may go into debt by one message; the next
+    // send waits until it is paid off.
+    std::chrono::steady_clock::time_point readyAt(std::chrono::steady_clock::time_point now);
+    void spend(size_t bytes);
+
+    // Any thread, from RADIO_STATUS.
+    void radioStatus(uint8_t txbufFree);
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+    double rate;
+    double tokens;
+    std::chrono::steady_clock::time_point last;
+    std::atomic<double> scale{1.0};
+};
+
+// Lock-free single-producer/single-consumer slot where only the newest value
+// survives. Three buffers: the producer writes one, the consumer reads one,
+// and the third is handed between them by an atomic exchange.
+template <typename T>
+class LatestMailbox
+{
+public:
+    // Producer only.
+    void post(const T &value)
+    {
+        slots[back] = value;
+        back = state.exchange(back | Dirty, std::memory_order_acq_rel) & Index;
+    }
+
+    // Consumer only. False if nothing was posted since the last take.
+    bool take(T &value)
+    {
+        if (!pending())
+            return false;
+        front = state.exchange(front, std::memory_order_acq_rel) & Index;
+        value = slots[front];
+        return true;
+    }
+
+    bool pending(void) const { return state.load(std::memory_order_acquire) & Dirty; }
+
+private:
+    static constexpr uint8_t Index = 0x3;
+    static constexpr uint8_t Dirty = 0x4;
+
+    T slots[3] = {};
+    std::atomic<uint8_t> state{1};  // Index of the middle slot, plus Dirty
+    uint8_t back = 0;               // Producer's slot
+    uint8_t front = 2;              // Consumer's slot
+};
+
+class LEDStripSender
+{
+public:
+    enum class Priority { Normal, Urgent };
+
+    LEDStripSender(mavsdk::MavlinkPassthrough &passthrough, double maxRateHz = LED_SEND_MAX_RATE_HZ,
+                   double linkBytesPerSecond = 0);
+    ~LEDStripSender();
+
+    // UI thread. Never blocks on the link.
+    void send(const mavlink_led_strip_config_t &config, Priority priority = Priority::Normal);
+
+    uint64_t droppedCount(void) const { return dropped.load(std::memory_order_relaxed); }
+    double budgetBytesPerSecond(void) const { return budget.bytesPerSecond(); }
+
+    // Time from send() to the message leaving, over everything sent so far.
+    uint64_t sentCount(void) const { return sent.load(std::memory_order_relaxed); }
+    double meanLatencyUs(void) const;
+    double maxLatencyUs(void) const { return maxLatencyNs.load(std::memory_order_relaxed) / 1e3; }
+
+private:
+    struct Posted {
+        mavlink_led_strip_config_t config;
+        std::chrono::steady_clock::time_point at;
+        uint64_t order;
+    };
+
+    void run(void);
+
+    mavsdk::MavlinkPassthrough &passthrough;
+    std::chrono::nanoseconds interval;
+    LatestMailbox<Posted> urgent;
+    LatestMailbox<Posted> normal;
+    uint64_t nextOrder = 1;             // UI thread only
+    LinkBudget budget;
+
+    // Only for sleeping; the mailbox itself takes no lock.
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> totalLatencyNs{0};
+    std::atomic<uint64_t> maxLatencyNs{0};
+
+    std::thread thread;
+};
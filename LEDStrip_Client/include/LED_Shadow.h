@@ -0,0 +1,80 @@
+// Per-LED editing with a shadow copy of what the vehicle shows.
+//
+// Edits go into a staged frame. flush() diffs it against the shadow and
+// encodes the difference into as few LED_STRIP_CONFIG messages as it can:
+// one vehicle-wide ALL fill, per-strip fills, and INDEX ranges of up to
+// LED_STRIP_CONFIG_MAX_COLOURS colours for whatever those leave wrong. On a
+// 57600 baud radio every message saved is about 8 ms of air time.
+//
+// The shadow is kept per LED, and only LEDs the emitted messages wrote are
+// known. LEDs that were never set are never sent: a fill only covers them if
+// every LED it reaches has been set, and an INDEX range stops short of them
+// unless the vehicle is known to show something there already.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include "LEDStrip_Common/LEDStrip_Protocol.h"
+
+#define LED_SHADOW_MAX_STRIPS 254       // strip_id 254/255 mean status/all
+#define LED_SHADOW_MAX_LEDS 256         // led_index is a uint8_t
+
+class LEDStripShadow
+{
+public:
+    // Strips and LEDs per strip as configured on the server (-a/-l).
+    LEDStripShadow(unsigned strips, unsigned leds, const mavlink_led_strip_config_t &base);
+
+    unsigned strips(void) const { return stripCount; }
+    unsigned leds(void) const { return ledCount; }
+
+    void set(unsigned strip, unsigned led, uint32_t colour);
+    void fillStrip(unsigned strip, uint32_t colour);
+    void fill(uint32_t colour);
+    uint32_t get(unsigned strip, unsigned led) const { return staged[strip * ledCount + led]; }
+
+    // The vehicle's LEDs are no longer known (follow mode, reconnect...). The
+    // next flush sends every LED that has been set.
+    void invalidate(void) { std::fill(known.begin(), known.end(), 0); }
+
+    // Appends the messages that bring the vehicle from the shadow to the
+    // staged frame, in the order they must be applied, then records what
+    // they wrote in the shadow. Returns how many were appended.
+    size_t flush(std::vector<mavlink_led_strip_config_t> &out);
+
+    // Whether the vehicle is known to show the staged colour at this LED.
+    bool shown(unsigned strip, unsigned led) const
+    {
+        unsigned i = strip * ledCount + led;
+        return known[i] && shadow[i] == staged[i];
+    }
+
+    // MAVLink v2 frame size, after trailing-zero payload truncation.
+    static size_t wireBytes(const mavlink_led_strip_config_t &config);
+
+private:
+    // LEDs of the strip that need writing after the strip holds `under`.
+    // With under == nullptr they are the set LEDs not known to show their
+    // staged colour.
+    unsigned ranges(unsigned strip, const uint32_t *under) const;
+    void emitRanges(unsigned strip, const uint32_t *under, std::vector<mavlink_led_strip_config_t> &out) const;
+    unsigned rangeEnd(unsigned strip, unsigned led, const uint32_t *under) const;
+    bool needs(unsigned strip, unsigned led, const uint32_t *under) const;
+    bool allSet(unsigned first, unsigned count) const;
+    uint32_t dominant(unsigned first, unsigned count);
+    bool stripChanged(unsigned strip) const;
+    void apply(const mavlink_led_strip_config_t &config);
+
+    unsigned stripCount;
+    unsigned ledCount;
+    mavlink_led_strip_config_t base;
+    std::vector<uint32_t> staged;
+    std::vector<uint32_t> shadow;
+    std::vector<uint32_t> scratch;
+    std::vector<uint8_t> defined;       // The LED has a staged colour
+    std::vector<uint8_t> known;         // The shadow holds what the LED shows
+};
@@ -0,0 +1,97 @@
+// Keyframe timelines: fades and sequences authored as keys, compiled into the
+// fewest timed commands that reproduce them.
+//
+// One key per line, '#' starts a comment:
+//   MS RRGGBB          show the colour from MS milliseconds into the show
+//   MS RRGGBB fade     fade from the previous key's colour, arriving at MS
+//                      (after a follow key, a cut at MS instead)
+//   MS follow          follow the flight mode again
+//
+// compile() keeps only the last of several keys at the same time and drops
+// keys that change nothing. With vehicle fades (LED_FADE_* in
+// LEDStrip_Protocol.h) a fade is one command at the previous key's time.
+// Without them a fade is sampled no faster than maxRateHz and no finer than one
+// 8-bit step, dropping samples that repeat the last one. Every command goes
+// out ahead of time with an execute-at, so the link carries changes rather
+// than frames.
+//
+// The compiled schedule can be cached as a compact binary file, keyed by a
+// hash of the keys and options, so replaying an unchanged show skips the
+// compiler.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include "LEDStrip_Common/LEDStrip_Protocol.h"
+
+#define TIMELINE_SAMPLE_RATE_HZ 20      // Fade samples without vehicle fades
+#define TIMELINE_NAIVE_RATE_HZ 60       // Per-frame streaming we compare against
+#define TIMELINE_CACHE_SUFFIX ".ledt"
+
+struct Keyframe
+{
+    enum class Kind : uint8_t { Colour, Follow };
+
+    uint32_t atMs;
+    Kind kind;
+    uint32_t colour;
+    bool fade;
+};
+
+struct TimedCommand
+{
+    enum class Kind : uint8_t { Colour, Fade, Follow };
+
+    uint32_t atMs;
+    Kind kind;
+    uint32_t colour;
+    uint32_t durationMs;
+};
+
+struct TimelineCost
+{
+    size_t commands;
+    size_t bytes;
+};
+
+class LEDTimeline
+{
+public:
+    // False on a malformed key, reported on std::cerr as name:line.
+    bool parse(std::istream &in, const std::string &name);
+
+    const std::vector<Keyframe> &keys(void) const { return keyframes; }
+    uint32_t durationMs(void) const { return keyframes.empty() ? 0 : keyframes.back().atMs; }
+
+    void compile(bool vehicleFades, unsigned maxRateHz = TIMELINE_SAMPLE_RATE_HZ);
+    const std::vector<TimedCommand> &commands(void) const { return compiled; }
+
+    // loadCompiled() is false if the file is missing, damaged or was compiled
+    // from other keys or options; the schedule is then left alone.
+    bool loadCompiled(const std::string &path, bool vehicleFades, unsigned maxRateHz = TIMELINE_SAMPLE_RATE_HZ);
+    bool saveCompiled(const std::string &path) const;
+
+    // The command as sent: base's target, executing at showStartUs + atMs.
+    static mavlink_led_strip_config_t message(const TimedCommand &command, const mavlink_led_strip_config_t &base,
+                                              uint64_t showStartUs);
+
+    // The compiled schedule as sent, against sending what the timeline shows
+    // on every frame at frameRateHz for the length of the show.
+    TimelineCost cost(const mavlink_led_strip_config_t &base, uint64_t showStartUs) const;
+    TimelineCost naiveCost(const mavlink_led_strip_config_t &base, unsigned frameRateHz = TIMELINE_NAIVE_RATE_HZ) const;
+
+private:
+    // What the show looks like at atMs: the key in force, blended into the
+    // next one if that fades. False before the first key.
+    bool stateAt(uint32_t atMs, Keyframe::Kind &kind, uint32_t &colour) const;
+    uint64_t hash(bool vehicleFades, unsigned maxRateHz) const;
+
+    std::vector<Keyframe> keyframes;
+    std::vector<TimedCommand> compiled;
+    uint64_t compiledHash = 0;
+};
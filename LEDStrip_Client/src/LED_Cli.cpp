@@ -0,0 +1,397 @@
+// Headless LED client: runs a script of LED commands against one vehicle.
+//
+// One command per line, '#' starts a comment:
+//   colour RRGGBB      fill every LED (also "color"; 0x prefix optional)
+//   cycle              fill with the next colour of ArrayOfColours
+//   follow             follow the flight mode again
+//   strip N|all        strip the following commands address
+//   target SYS COMP    LED component the following commands address
+//   pixel S I RRGGBB   set LED I of strip S; sent by the next "show"
+//   show               send every pixel change since the last show, as few
+//                      messages as the shadow copy can manage (LED_Shadow.h)
+//   wait MS            pause MS milliseconds after the previous command
+//   at MS              pause until MS milliseconds after the vehicle was found
+//
+// The whole script is parsed before connecting, so a typo fails straight away
+// instead of halfway through a show.
+//
+// With -F the script drives a whole fleet instead: every vehicle heard on the
+// UDP port is sent every command, each addressed to that vehicle.
+//
+// With -T a keyframe timeline (LED_Timeline.h) runs instead of a script. It
+// is compiled to timed commands, cached beside the file, and each command is
+// sent TIMELINE_LEAD_MS before it is due so the vehicle applies it on time.
+#include <algorithm>
+#include <getopt.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LED_Client.h"
+#include "LED_Fleet.h"
+#include "LED_Shadow.h"
+#include "LED_Timeline.h"
+
+#define TIMELINE_LEAD_MS 500
+
+using namespace mavsdk;
+using std::chrono::steady_clock;
+
+struct Step
+{
+    enum class Kind { Send, Wait, At };
+
+    Kind kind;
+    int64_t ms;
+    mavlink_led_strip_config_t config;
+};
+
+void usage(const std::string &bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " [-F] [-L strips,leds] [-c commands] [-t timeout_s] <connection_url> [script]\n"
+              << "        " << bin_name << " [-F] [-f] [-n] [-t timeout_s] -T timeline [connection_url]\n"
+              << "Runs LED commands from script, from -c (';' separated) or from stdin.\n"
+              << "-F sends to every vehicle heard on udp://:port within timeout_s (and\n"
+              << "   later); target is then set per vehicle.\n"
+              << "Commands: colour RRGGBB, cycle, follow, strip N|all, target SYS COMP,\n"
+              << "          pixel S I RRGGBB, show, wait MS, at MS. '#' starts a comment.\n"
+              << "-L gives the vehicle's strip layout for pixel (default 2,5).\n"
+              << "-T plays a timeline of keys: MS RRGGBB [fade], MS follow. -f if the\n"
+              << "   vehicle can fade, -n to only compile it and report the traffic.\n"
+              << "Connection URL format should be :\n"
+              << " For TCP : tcp://[server_host][:server_port]\n"
+              << " For UDP : udp://[bind_host][:bind_port]\n"
+              << " For Serial : serial:///path/to/serial/dev[:baudrate]\n"
+              << std::endl;
+}
+
+static bool parseNumber(std::istringstream &words, long min, long max, long &value, int base = 10)
+{
+    std::string word;
+    if (!(words >> word))
+        return false;
+
+    char *end;
+    value = strtol(word.c_str(), &end, base);
+    return *end == '\0' && value >= min && value <= max;
+}
+
+// Appends the steps for one line. Returns false on a malformed command.
+bool parseLine(const std::string &line, mavlink_led_strip_config_t &config, LEDStripShadow &shadow,
+               std::vector<Step> &steps)
+{
+    std::vector<mavlink_led_strip_config_t> delta;
+    std::istringstream words(line.substr(0, line.find('#')));
+    std::string command, extra;
+    long value, value2;
+
+    if (!(words >> command))
+        return true;
+
+    Step step = {};
+    step.kind = Step::Kind::Send;
+
+    if (command == "colour" || command == "color") {
+        if (!parseNumber(words, 0, 0xFFFFFF, value, 16))
+            return false;
+        setLEDFillColour(value, config);
+    }
+    else if (command == "cycle") {
+        setLEDFillColour(cycleLEDColour(), config);
+    }
+    else if (command == "follow") {
+        setFollowFlightMode(config);
+    }
+    else if (command == "pixel") {
+        if (!parseNumber(words, 0, shadow.strips() - 1, value) || !parseNumber(words, 0, shadow.leds() - 1, value2))
+            return false;
+        long colour;
+        if (!parseNumber(words, 0, 0xFFFFFF, colour, 16))
+            return false;
+        shadow.set(value, value2, colour);
+        return !(words >> extra);
+    }
+    else if (command == "show") {
+        if (words >> extra)
+            return false;
+        shadow.flush(delta);
+        for (auto &message : delta) {
+            message.target_system = config.target_system;
+            message.target_component = config.target_component;
+            steps.push_back(Step{Step::Kind::Send, 0, message});
+        }
+        return true;
+    }
+    else if (command == "strip") {
+        std::string id;
+        if (!(words >> id))
+            return false;
+        if (id == "all") {
+            config.strip_id = UINT8_MAX;
+        } else {
+            std::istringstream number(id);
+            if (!parseNumber(number, 0, UINT8_MAX - 2, value))
+                return false;
+            config.strip_id = value;
+        }
+        return !(words >> extra);
+    }
+    else if (command == "target") {
+        if (!parseNumber(words, 1, UINT8_MAX, value) || !parseNumber(words, 1, UINT8_MAX, value2))
+            return false;
+        config.target_system = value;
+        config.target_component = value2;
+        return !(words >> extra);
+    }
+    else if (command == "wait" || command == "at") {
+        if (!parseNumber(words, 0, INT32_MAX, value))
+            return false;
+        step.kind = (command == "wait") ? Step::Kind::Wait : Step::Kind::At;
+        step.ms = value;
+    }
+    else {
+        return false;
+    }
+
+    if (words >> extra)
+        return false;
+
+    // Keep the shadow in step with whole fills, so "show" only sends pixels.
+    if (step.kind == Step::Kind::Send) {
+        if (config.fill_mode == LED_FILL_MODE_FOLLOW_FLIGHT_MODE) {
+            shadow.invalidate();
+        } else {
+            if (config.strip_id == UINT8_MAX)
+                shadow.fill(config.colors[0]);
+            else
+                shadow.fillStrip(config.strip_id, config.colors[0]);
+            shadow.flush(delta);
+        }
+    }
+
+    step.config = config;
+    steps.push_back(step);
+    return true;
+}
+
+// Compiles the timeline, or takes it from the cache if nothing changed, and
+// reports what it costs on the link against streaming every frame.
+bool compileTimeline(const std::string &path, bool vehicleFades, LEDTimeline &timeline)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open " << path << '\n';
+        return false;
+    }
+    if (!timeline.parse(in, path))
+        return false;
+
+    auto before = steady_clock::now();
+    std::string cache = path + TIMELINE_CACHE_SUFFIX;
+    bool cached = timeline.loadCompiled(cache, vehicleFades);
+    if (!cached) {
+        timeline.compile(vehicleFades);
+        if (!timeline.saveCompiled(cache))
+            std::cerr << "Cannot write " << cache << '\n';
+    }
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - before).count();
+
+    auto base = makeLEDStripConfig();
+    uint64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    TimelineCost compiled = timeline.cost(base, nowUs);
+    TimelineCost naive = timeline.naiveCost(base);
+    std::cout << path << ": " << timeline.keys().size() << " keys, " << timeline.durationMs() << "ms, "
+              << (cached ? "cached" : "compiled") << " in " << took << "us\n"
+              << "  timed commands: " << compiled.commands << " (" << compiled.bytes << " B)\n"
+              << "  per-frame at " << TIMELINE_NAIVE_RATE_HZ << " Hz: " << naive.commands
+              << " (" << naive.bytes << " B)" << std::endl;
+    return true;
+}
+
+bool parseScript(std::istream &script, const std::string &name, unsigned strips, unsigned leds, std::vector<Step> &steps)
+{
+    mavlink_led_strip_config_t config = makeLEDStripConfig();
+    LEDStripShadow shadow(strips, leds, config);
+    std::string line;
+    int lineNo = 0;
+
+    while (std::getline(script, line)) {
+        lineNo++;
+        if (!parseLine(line, config, shadow, steps)) {
+            std::cerr << name << ":" << lineNo << ": invalid command: " << line << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    auto start = steady_clock::now();
+    std::string commands;
+    double timeout = 3.0;
+    bool fleetMode = false;
+    bool vehicleFades = false, dryRun = false;
+    const char *timelinePath = nullptr;
+    unsigned strips = 2, leds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:fFL:nt:T:h")) != -1) {
+        switch (opt) {
+        case 'F':
+            fleetMode = true;
+            break;
+        case 'L':
+            if (sscanf(optarg, "%u,%u", &strips, &leds) != 2 || !strips || !leds
+                    || strips > LED_SHADOW_MAX_STRIPS || leds > LED_SHADOW_MAX_LEDS) {
+                std::cerr << "invalid layout " << optarg << '\n';
+                return 1;
+            }
+            break;
+        case 'c':
+            commands = optarg;
+            std::replace(commands.begin(), commands.end(), ';', '\n');
+            break;
+        case 't':
+            timeout = atof(optarg);
+            break;
+        case 'T':
+            timelinePath = optarg;
+            break;
+        case 'f':
+            vehicleFades = true;
+            break;
+        case 'n':
+            dryRun = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    LEDTimeline timeline;
+    if (timelinePath) {
+        if (!compileTimeline(timelinePath, vehicleFades, timeline))
+            return 1;
+        if (dryRun)
+            return 0;
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *url = argv[optind];
+    const char *scriptPath = (optind + 1 < argc) ? argv[optind + 1] : nullptr;
+
+    std::vector<Step> steps;
+    bool parsed = true;
+    if (timelinePath) {
+        // The timeline replaces the script
+    } else if (!commands.empty()) {
+        std::istringstream script(commands);
+        parsed = parseScript(script, "-c", strips, leds, steps);
+    } else if (scriptPath && std::string(scriptPath) != "-") {
+        std::ifstream script(scriptPath);
+        if (!script) {
+            std::cerr << "Cannot open " << scriptPath << '\n';
+            return 1;
+        }
+        parsed = parseScript(script, scriptPath, strips, leds, steps);
+    } else {
+        parsed = parseScript(std::cin, "stdin", strips, leds, steps);
+    }
+    if (!parsed)
+        return 1;
+
+    std::unique_ptr<Mavsdk> mavsdk;
+    std::unique_ptr<MavlinkPassthrough> mavlink_passthrough;
+    std::unique_ptr<LEDFleet> fleet;
+
+    if (fleetMode) {
+        const char *port = strrchr(url, ':');
+        fleet = std::make_unique<LEDFleet>(port ? atoi(port + 1) : 0);
+        if (!fleet->ok())
+            return 1;
+
+        // Vehicles keep being added as they appear; this is just a head start.
+        std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+        if (!fleet->size()) {
+            std::cerr << "No vehicles found\n";
+            return 1;
+        }
+        std::cout << "Found " << fleet->size() << " vehicles" << std::endl;
+    } else {
+        mavsdk = std::make_unique<Mavsdk>(Mavsdk::Configuration{Mavsdk::ComponentType::GroundStation});
+        mavsdk->set_configuration(Mavsdk::Configuration(1, 135, true));
+        ConnectionResult connection_result = mavsdk->add_any_connection(url);
+
+        if (connection_result != ConnectionResult::Success) {
+            std::cerr << "Connection failed: " << connection_result << '\n';
+            return 1;
+        }
+
+        auto system = mavsdk->first_autopilot(timeout);
+        if (!system) {
+            std::cerr << "Timed out waiting for system\n";
+            return 1;
+        }
+        mavlink_passthrough = std::make_unique<MavlinkPassthrough>(system.value());
+    }
+
+    auto ready = steady_clock::now();
+    std::cout << "Ready in " << std::chrono::duration_cast<std::chrono::milliseconds>(ready - start).count()
+              << "ms" << std::endl;
+
+    // The show starts TIMELINE_LEAD_MS from now; each command goes out that
+    // far ahead of its time.
+    if (timelinePath) {
+        uint64_t showStartUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() + TIMELINE_LEAD_MS * 1000;
+        auto base = makeLEDStripConfig();
+        for (const auto &command : timeline.commands()) {
+            std::this_thread::sleep_until(ready + std::chrono::milliseconds(command.atMs));
+            auto config = LEDTimeline::message(command, base, showStartUs);
+            if (fleet)
+                fleet->send(config);
+            else
+                sendLedStripConfig(*mavlink_passthrough, config);
+        }
+        std::this_thread::sleep_until(ready + std::chrono::milliseconds(timeline.durationMs() + TIMELINE_LEAD_MS));
+        return 0;
+    }
+
+    // Script times count from here, once the vehicle is reachable.
+    for (const auto &step : steps) {
+        switch (step.kind) {
+        case Step::Kind::Wait:
+            std::this_thread::sleep_for(std::chrono::milliseconds(step.ms));
+            break;
+
+        case Step::Kind::At:
+            std::this_thread::sleep_until(ready + std::chrono::milliseconds(step.ms));
+            break;
+
+        case Step::Kind::Send:
+            std::cout << "[" << std::dec
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(steady_clock::now() - ready).count()
+                      << "ms] ";
+            if (fleet) {
+                auto before = steady_clock::now();
+                size_t sent = fleet->send(step.config);
+                std::cout << "sent to " << sent << " vehicles in "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - before).count()
+                          << "us" << std::endl;
+            } else {
+                sendLedStripConfig(*mavlink_passthrough, step.config);
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -22,15 +22,18 @@ uint32_t ArrayOfColours[] =
 
 uint8_t NoOfColours = sizeof(ArrayOfColours) / sizeof(uint32_t);
 
-mavlink_led_strip_config_t LEDStripConfig{
-    .colors = {0, 0, 0, 0, 0, 0, 0, 0},
-    .target_system = 1,
-    .target_component = 134,
-    .fill_mode = LED_FILL_MODE_ALL,
-    .led_index = 0,
-    .length = 8,
-    .strip_id = UINT8_MAX,
-};
+mavlink_led_strip_config_t makeLEDStripConfig(uint8_t target_system, uint8_t target_component)
+{
+    return mavlink_led_strip_config_t{
+        .colors = {0, 0, 0, 0, 0, 0, 0, 0},
+        .target_system = target_system,
+        .target_component = target_component,
+        .fill_mode = LED_FILL_MODE_ALL,
+        .led_index = 0,
+        .length = 8,
+        .strip_id = UINT8_MAX,
+    };
+}
 
 void setFollowFlightMode(mavlink_led_strip_config_t &LEDStripConfig)
 {
@@ -61,7 +64,7 @@ void sendLedStripConfig(MavlinkPassthrough &mavlink_passthrough, const mavlink_l
         std::cout << "Attempted to send follow flight mode" << std::endl;
 }
 
-static uint32_t cycleLEDColour(void)
+uint32_t cycleLEDColour(void)
 {
     static int ColourIndex;
     ColourIndex++;
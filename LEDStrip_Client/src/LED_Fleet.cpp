@@ -0,0 +1,160 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "LED_Client.h"
+#include "LED_Fleet.h"
+
+LEDFleet::LEDFleet(uint16_t port, uint8_t sysid, uint8_t compid) :
+    sysid(sysid),
+    compid(compid)
+{
+    vehicles.reserve(FLEET_MAX_VEHICLES);
+    batch.resize(FLEET_MAX_VEHICLES);
+    iov.resize(FLEET_MAX_VEHICLES);
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        std::cerr << "fleet: cannot bind UDP port " << port << ": " << strerror(errno) << '\n';
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        return;
+    }
+
+    // Lets the receive thread notice shutdown
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    thread = std::thread(&LEDFleet::receive, this);
+}
+
+LEDFleet::~LEDFleet()
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    if (fd >= 0)
+        close(fd);
+}
+
+size_t LEDFleet::size(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return vehicles.size();
+}
+
+void LEDFleet::receive(void)
+{
+    uint8_t buffer[2048];
+    struct sockaddr_storage from;
+    mavlink_message_t partial, message;
+    mavlink_status_t status, frameStatus;
+
+    while (running.load(std::memory_order_relaxed)) {
+        socklen_t fromLen = sizeof(from);
+        ssize_t len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLen);
+
+        // Datagrams hold whole frames, so each starts a fresh parse.
+        memset(&status, 0, sizeof(status));
+        for (ssize_t i = 0; i < len; i++) {
+            if (mavlink_frame_char_buffer(&partial, &status, buffer[i], &message, &frameStatus) != MAVLINK_FRAMING_OK)
+                continue;
+            if (message.msgid == MAVLINK_MSG_ID_HEARTBEAT && message.compid == MAV_COMP_ID_AUTOPILOT1)
+                heard(message.sysid, from, fromLen);
+        }
+    }
+}
+
+void LEDFleet::heard(uint8_t vehicleSysid, const struct sockaddr_storage &address, socklen_t addressLen)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto &vehicle : vehicles) {
+        if (vehicle.sysid == vehicleSysid) {
+            // Follow the vehicle if its link moves
+            vehicle.address = address;
+            vehicle.addressLen = addressLen;
+            return;
+        }
+    }
+
+    if (vehicles.size() == FLEET_MAX_VEHICLES)
+        return;
+
+    Vehicle vehicle = {};
+    vehicle.sysid = vehicleSysid;
+    vehicle.address = address;
+    vehicle.addressLen = addressLen;
+    vehicles.push_back(vehicle);
+    std::cout << "fleet: found vehicle " << std::dec << (int)vehicleSysid << std::endl;
+}
+
+// Every copy is the same frame but for target_system, so the command is
+// encoded once and each copy only has that byte and the CRC patched. The CRC
+// of everything before the patched byte is shared as well.
+size_t LEDFleet::send(const mavlink_led_strip_config_t &config)
+{
+    mavlink_led_strip_config_t addressed = config;
+    mavlink_message_t message;
+    uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+    std::lock_guard<std::mutex> guard(lock);
+    size_t count = vehicles.size();
+    if (!count)
+        return 0;
+
+    // target_component follows target_system and is never zero, so payload
+    // truncation can't depend on which vehicle the copy is for.
+    addressed.target_system = 1;
+    addressed.target_component = LED_TARGET_COMPONENT;
+    mavlink_msg_led_strip_config_encode(sysid, compid, &message, &addressed);
+    size_t len = mavlink_msg_to_send_buffer(frame, &message);
+
+    const size_t target = MAVLINK_NUM_HEADER_BYTES + FLEET_TARGET_SYSTEM_OFFSET;
+    const size_t checksum = MAVLINK_NUM_HEADER_BYTES + message.len;
+    uint16_t prefix;
+    crc_init(&prefix);
+    for (size_t b = 1; b < target; b++)
+        crc_accumulate(frame[b], &prefix);
+
+    for (size_t i = 0; i < count; i++) {
+        Vehicle &vehicle = vehicles[i];
+        memcpy(vehicle.frame, frame, len);
+        vehicle.frame[target] = vehicle.sysid;
+
+        uint16_t crc = prefix;
+        for (size_t b = target; b < checksum; b++)
+            crc_accumulate(vehicle.frame[b], &crc);
+        crc_accumulate(MAVLINK_MSG_ID_LED_STRIP_CONFIG_CRC, &crc);
+        vehicle.frame[checksum] = crc & 0xFF;
+        vehicle.frame[checksum + 1] = crc >> 8;
+
+        iov[i].iov_base = vehicle.frame;
+        iov[i].iov_len = len;
+        batch[i].msg_hdr.msg_name = &vehicle.address;
+        batch[i].msg_hdr.msg_namelen = vehicle.addressLen;
+        batch[i].msg_hdr.msg_iov = &iov[i];
+        batch[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // One syscall for the whole fleet. sendmmsg stops at the first vehicle
+    // that fails; skip it and carry on with the rest.
+    size_t next = 0, sent = 0;
+    while (next < count) {
+        int done = sendmmsg(fd, batch.data() + next, count - next, 0);
+        if (done <= 0) {
+            std::cerr << "fleet: send to vehicle " << std::dec << (int)vehicles[next].sysid
+                      << " failed: " << strerror(errno) << '\n';
+            next++;
+            continue;
+        }
+        next += done;
+        sent += done;
+    }
+    return sent;
+}
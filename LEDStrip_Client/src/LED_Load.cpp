@@ -0,0 +1,314 @@
+// LED command load generator: how many LED_STRIP_CONFIG messages per second
+// can LEDStrip_Server absorb before it drops or falls behind?
+//
+// Frames are MAVLink v2, encoded up front for every value of the header's
+// sequence byte, so the send loop only copies pointers into sendmmsg. The
+// server's status reports (LEDStrip_Common/LEDStrip_Protocol.h) echo the
+// sequence of the last applied command and a running applied count; those
+// give latency and loss. Run the server with a high --status-rate, e.g. 1000,
+// or there will be few latency samples.
+//
+// The sequence byte repeats every LOAD_FRAMES messages, so a report names one
+// of several messages sent with it. The applied count bounds which: the
+// server can't have echoed a message older than the count says it has got
+// to. A report that still fits more than one message is left out of the
+// percentiles and counted as at least LOAD_FRAMES messages late.
+#include <getopt.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+#include "LED_Client.h"
+#include "LEDStrip_Common/LEDStrip_Protocol.h"
+
+#define LOAD_FRAMES         256     // One per MAVLink sequence number
+#define LOAD_MAX_BURST      64
+#define LOAD_DRAIN_MS       1000    // Wait for the last reports after sending
+
+enum class Pattern { Solid, Index, Toggle };
+
+struct Frame
+{
+    uint8_t bytes[MAVLINK_MAX_PACKET_LEN];
+    uint16_t len;
+};
+
+static Frame frames[LOAD_FRAMES];
+static std::atomic<int64_t> sentAtNs[LOAD_FRAMES];
+static std::atomic<int64_t> sentIndex[LOAD_FRAMES];    // Newest message sent with each sequence number
+static std::atomic<bool> receiving{true};
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void usage(const std::string &bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " [options] <host:port>\n"
+              << "Sends LED_STRIP_CONFIG over UDP to host:port (the server's --fast-path\n"
+              << "port, or a udp:// endpoint) and reports rate, loss and latency.\n"
+              << " -r rate      messages per second (default 100)\n"
+              << " -d seconds   test duration (default 10)\n"
+              << " -p pattern   solid, index or toggle (default solid)\n"
+              << " -b burst     messages sent back to back per tick (default 1)\n"
+              << " -n leds      LEDs per strip for the index pattern (default 5)\n"
+              << " -s sysid     our system id (default 1)\n"
+              << " -c compid    our component id (default 135)\n"
+              << std::endl;
+}
+
+// Payload for message i of the pattern
+static mavlink_led_strip_config_t makePayload(Pattern pattern, unsigned i, unsigned leds)
+{
+    mavlink_led_strip_config_t config = makeLEDStripConfig();
+    uint32_t colour = ArrayOfColours[i % NoOfColours];
+
+    switch (pattern) {
+    case Pattern::Solid:
+        setLEDFillColour(colour, config);
+        config.length = 1;
+        break;
+
+    case Pattern::Index:
+        setLEDFillColour(colour, config);
+        config.fill_mode = LED_FILL_MODE_INDEX;
+        config.led_index = i % leds;
+        config.length = 1;
+        break;
+
+    case Pattern::Toggle:
+        if (i & 1)
+            setFollowFlightMode(config);
+        else
+            setLEDFillColour(colour, config);
+        config.length = 1;
+        break;
+    }
+    return config;
+}
+
+static void buildFrames(Pattern pattern, unsigned leds, uint8_t sysid, uint8_t compid)
+{
+    mavlink_message_t message;
+    mavlink_status_t *status = mavlink_get_channel_status(MAVLINK_COMM_0);
+
+    for (unsigned seq = 0; seq < LOAD_FRAMES; seq++) {
+        mavlink_led_strip_config_t config = makePayload(pattern, seq, leds);
+        status->current_tx_seq = seq;
+        mavlink_msg_led_strip_config_encode(sysid, compid, &message, &config);
+        frames[seq].len = mavlink_msg_to_send_buffer(frames[seq].bytes, &message);
+    }
+}
+
+struct Results
+{
+    std::vector<int64_t> latencyNs;
+    uint64_t reports = 0;
+    uint64_t tooLate = 0;       // Reports that fit more than one send
+    bool haveCount = false;
+    uint32_t firstCount = 0;
+    uint32_t lastCount = 0;
+    int64_t firstIndex = 0;     // Our message the first report acknowledged
+};
+
+// Reads status reports until told to stop.
+static void receive(int fd, uint8_t sysid, uint8_t compid, Results &results)
+{
+    uint8_t buffer[2048];
+    mavlink_message_t message;
+    mavlink_status_t status;
+    uint32_t ours = packLEDCommandId(sysid, compid, 0) >> 8;
+
+    while (receiving.load(std::memory_order_relaxed)) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        int64_t now = nowNs();
+
+        for (ssize_t i = 0; i < len; i++) {
+            if (mavlink_parse_char(MAVLINK_COMM_1, buffer[i], &message, &status) != MAVLINK_FRAMING_OK
+                    || message.msgid != LED_STRIP_CONFIG_MSG_ID)
+                continue;
+
+            mavlink_led_strip_config_t report;
+            mavlink_msg_led_strip_config_decode(&message, &report);
+            uint32_t last = report.colors[LED_STATUS_LAST_COMMAND_SLOT];
+            if (!isLEDStatus(report) || (last >> 8) != ours)
+                continue;
+
+            uint8_t seq = last & 0xFF;
+            int64_t sentAt = sentAtNs[seq].load(std::memory_order_relaxed);
+            if (!sentAt)
+                continue;
+
+            results.reports++;
+            int64_t index = sentIndex[seq].load(std::memory_order_relaxed);
+            uint32_t count = report.colors[LED_STATUS_APPLIED_COUNT_SLOT];
+            if (!results.haveCount) {
+                results.haveCount = true;
+                results.firstCount = count;
+                results.firstIndex = index;
+            }
+            results.lastCount = count;
+
+            // Our oldest message this report can be about; anything older
+            // was applied before the count got here.
+            int64_t oldest = results.firstIndex + (uint32_t)(count - results.firstCount);
+            if (index - LOAD_FRAMES >= oldest) {
+                results.tooLate++;
+                continue;
+            }
+            results.latencyNs.push_back(now - sentAt);
+        }
+    }
+}
+
+static double percentileMs(std::vector<int64_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()));
+    return sorted[i] / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    double rate = 100, duration = 10;
+    unsigned burst = 1, leds = 5;
+    long sysid = 1, compid = 135;
+    Pattern pattern = Pattern::Solid;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:d:p:b:n:s:c:h")) != -1) {
+        switch (opt) {
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'b': burst = atoi(optarg); break;
+        case 'n': leds = atoi(optarg); break;
+        case 's': sysid = atol(optarg); break;
+        case 'c': compid = atol(optarg); break;
+        case 'p':
+            if (!strcmp(optarg, "solid"))
+                pattern = Pattern::Solid;
+            else if (!strcmp(optarg, "index"))
+                pattern = Pattern::Index;
+            else if (!strcmp(optarg, "toggle"))
+                pattern = Pattern::Toggle;
+            else {
+                std::cerr << "invalid pattern " << optarg << "\n";
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || rate <= 0 || duration <= 0 || burst < 1 || burst > LOAD_MAX_BURST
+            || leds < 1 || leds > UINT8_MAX || sysid < 1 || sysid > UINT8_MAX || compid < 1 || compid > UINT8_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string target = argv[optind];
+    size_t colon = target.rfind(':');
+    if (colon == std::string::npos) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct addrinfo hints = {}, *address;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(target.substr(0, colon).c_str(), target.substr(colon + 1).c_str(), &hints, &address) != 0) {
+        std::cerr << "Cannot resolve " << target << '\n';
+        return 1;
+    }
+
+    int fd = socket(address->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, address->ai_addr, address->ai_addrlen) < 0) {
+        std::cerr << "Cannot connect to " << target << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+    freeaddrinfo(address);
+
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    buildFrames(pattern, leds, sysid, compid);
+
+    uint64_t total = (uint64_t)(rate * duration);
+    Results results;
+    results.latencyNs.reserve(total);
+    std::thread receiver(receive, fd, sysid, compid, std::ref(results));
+
+    struct iovec iov[LOAD_MAX_BURST];
+    struct mmsghdr batch[LOAD_MAX_BURST] = {};
+    int64_t tickNs = (int64_t)(burst * 1e9 / rate);
+    int64_t start = nowNs(), next = start;
+    uint64_t sent = 0, sendErrors = 0;
+
+    while (sent < total) {
+        unsigned count = std::min<uint64_t>(burst, total - sent);
+        int64_t now = nowNs();
+
+        for (unsigned i = 0; i < count; i++) {
+            unsigned seq = (sent + i) % LOAD_FRAMES;
+            iov[i].iov_base = frames[seq].bytes;
+            iov[i].iov_len = frames[seq].len;
+            batch[i].msg_hdr.msg_iov = &iov[i];
+            batch[i].msg_hdr.msg_iovlen = 1;
+            sentIndex[seq].store(sent + i, std::memory_order_relaxed);
+            sentAtNs[seq].store(now, std::memory_order_relaxed);
+        }
+
+        int done = sendmmsg(fd, batch, count, 0);
+        if (done < (int)count)
+            sendErrors += count - std::max(done, 0);
+        sent += count;
+
+        next += tickNs;
+        struct timespec until = { (time_t)(next / 1000000000), (long)(next % 1000000000) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+    }
+    int64_t elapsed = nowNs() - start;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOAD_DRAIN_MS));
+    receiving = false;
+    receiver.join();
+    close(fd);
+
+    std::cout << "Sent " << sent << " in " << elapsed / 1e9 << "s: " << sent * 1e9 / elapsed
+              << " msg/s (asked " << rate << "), " << sendErrors << " send errors\n";
+
+    if (!results.haveCount) {
+        std::cout << "No status reports received; is the server's --status-rate above 0?\n";
+        return 0;
+    }
+
+    // The first report already covered every message up to the one it echoed.
+    uint64_t applied = results.lastCount - results.firstCount + results.firstIndex + 1;
+    uint64_t lost = sent > applied ? sent - applied : 0;
+    std::sort(results.latencyNs.begin(), results.latencyNs.end());
+    std::cout << "Applied " << applied << ", lost " << lost << " (" << 100.0 * lost / sent << "%), "
+              << results.reports << " status reports\n"
+              << "Latency ms: p50 " << percentileMs(results.latencyNs, 50)
+              << " p90 " << percentileMs(results.latencyNs, 90)
+              << " p99 " << percentileMs(results.latencyNs, 99)
+              << " max " << percentileMs(results.latencyNs, 100) << std::endl;
+    if (results.tooLate)
+        std::cout << results.tooLate << " reports came more than " << LOAD_FRAMES << " messages ("
+                  << LOAD_FRAMES * 1e3 / rate << " ms at this rate) behind and are left out above\n";
+    return 0;
+}
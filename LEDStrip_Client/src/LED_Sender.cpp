@@ -0,0 +1,155 @@
+#include <algorithm>
+
+#include "LED_Client.h"
+#include "LED_Sender.h"
+#include "LED_Shadow.h"
+
+using namespace mavsdk;
+using std::chrono::steady_clock;
+
+double linkBytesPerSecond(const std::string &url)
+{
+    if (url.compare(0, 9, "serial://") != 0)
+        return 0;
+
+    size_t colon = url.rfind(':');
+    if (colon < 9)
+        return 0;
+    return atof(url.c_str() + colon + 1) / 10;
+}
+
+LinkBudget::LinkBudget(double linkBytesPerSecond, double share) :
+    rate(linkBytesPerSecond * share),
+    tokens(rate * LED_BUDGET_BURST_S),
+    last(steady_clock::now())
+{
+}
+
+void LinkBudget::refill(steady_clock::time_point now)
+{
+    double rateNow = bytesPerSecond();
+    double elapsed = std::chrono::duration<double>(now - last).count();
+    tokens = std::min(rateNow * LED_BUDGET_BURST_S, tokens + elapsed * rateNow);
+    last = now;
+}
+
+steady_clock::time_point LinkBudget::readyAt(steady_clock::time_point now)
+{
+    if (!limited())
+        return now;
+
+    refill(now);
+    if (tokens >= 0)
+        return now;
+    return now + std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(-tokens / bytesPerSecond()));
+}
+
+void LinkBudget::spend(size_t bytes)
+{
+    if (limited())
+        tokens -= bytes;
+}
+
+void LinkBudget::radioStatus(uint8_t txbufFree)
+{
+    double now = scale.load(std::memory_order_relaxed);
+    if (txbufFree < LED_RADIO_TXBUF_LOW)
+        now = std::max(LED_RADIO_MIN_SCALE, now / 2);
+    else if (txbufFree > LED_RADIO_TXBUF_HIGH)
+        now = std::min(1.0, now + 0.1);
+    scale.store(now, std::memory_order_relaxed);
+}
+
+LEDStripSender::LEDStripSender(MavlinkPassthrough &passthrough, double maxRateHz, double linkBytesPerSecond) :
+    passthrough(passthrough),
+    interval(maxRateHz > 0 ? std::chrono::nanoseconds((int64_t)(1e9 / maxRateHz)) : std::chrono::nanoseconds(0)),
+    budget(linkBytesPerSecond)
+{
+    if (budget.limited()) {
+        passthrough.subscribe_message_async(MAVLINK_MSG_ID_RADIO_STATUS, [this](const mavlink_message_t &message) {
+            mavlink_radio_status_t status;
+            mavlink_msg_radio_status_decode(&message, &status);
+            budget.radioStatus(status.txbuf);
+        });
+    }
+    thread = std::thread(&LEDStripSender::run, this);
+}
+
+LEDStripSender::~LEDStripSender()
+{
+    if (budget.limited())
+        passthrough.subscribe_message_async(MAVLINK_MSG_ID_RADIO_STATUS, nullptr);
+    {
+        std::lock_guard<std::mutex> guard(wakeLock);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void LEDStripSender::send(const mavlink_led_strip_config_t &config, Priority priority)
+{
+    Posted posted{config, steady_clock::now(), nextOrder++};
+    if (priority == Priority::Urgent)
+        urgent.post(posted);
+    else
+        normal.post(posted);
+
+    // Taking the lock, even empty, closes the gap between the sender finding
+    // the mailbox empty and it starting to wait.
+    { std::lock_guard<std::mutex> guard(wakeLock); }
+    wake.notify_one();
+}
+
+double LEDStripSender::meanLatencyUs(void) const
+{
+    uint64_t count = sent.load(std::memory_order_relaxed);
+    return count ? totalLatencyNs.load(std::memory_order_relaxed) / 1e3 / count : 0;
+}
+
+void LEDStripSender::run(void)
+{
+    Posted posted;
+    uint64_t lastOrder = 0;
+    std::unique_lock<std::mutex> lock(wakeLock);
+
+    while (true) {
+        wake.wait(lock, [this] { return stopping || urgent.pending() || normal.pending(); });
+        if (stopping)
+            break;
+
+        // Wait for the budget before picking, so whatever is newest by
+        // then is what goes out.
+        auto ready = budget.readyAt(steady_clock::now());
+        if (wake.wait_until(lock, ready, [this] { return stopping; }))
+            break;
+        lock.unlock();
+
+        if (!urgent.take(posted) && !normal.take(posted)) {
+            lock.lock();
+            continue;
+        }
+        if (posted.order < lastOrder) {
+            // Overtaken by an urgent state already sent
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            lock.lock();
+            continue;
+        }
+        lastOrder = posted.order;
+
+        sendLedStripConfig(passthrough, posted.config);
+        budget.spend(LEDStripShadow::wireBytes(posted.config));
+
+        auto now = steady_clock::now();
+        uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - posted.at).count();
+        sent.fetch_add(1, std::memory_order_relaxed);
+        totalLatencyNs.fetch_add(latency, std::memory_order_relaxed);
+        if (latency > maxLatencyNs.load(std::memory_order_relaxed))
+            maxLatencyNs.store(latency, std::memory_order_relaxed);
+        lock.lock();
+
+        // Rate cap. Whatever arrives meanwhile replaces the previous post.
+        wake.wait_until(lock, now + interval, [this] { return stopping; });
+    }
+}
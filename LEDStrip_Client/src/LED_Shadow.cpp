@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstring>
+
+#include "LED_Shadow.h"
+
+LEDStripShadow::LEDStripShadow(unsigned strips, unsigned leds, const mavlink_led_strip_config_t &base) :
+    stripCount(std::min<unsigned>(strips, LED_SHADOW_MAX_STRIPS)),
+    ledCount(std::min<unsigned>(leds, LED_SHADOW_MAX_LEDS)),
+    base(base),
+    staged(stripCount * ledCount, 0),
+    shadow(stripCount * ledCount, 0),
+    defined(stripCount * ledCount, 0),
+    known(stripCount * ledCount, 0)
+{
+}
+
+void LEDStripShadow::set(unsigned strip, unsigned led, uint32_t colour)
+{
+    if (strip < stripCount && led < ledCount) {
+        staged[strip * ledCount + led] = colour;
+        defined[strip * ledCount + led] = 1;
+    }
+}
+
+void LEDStripShadow::fillStrip(unsigned strip, uint32_t colour)
+{
+    if (strip < stripCount) {
+        std::fill_n(staged.begin() + strip * ledCount, ledCount, colour);
+        std::fill_n(defined.begin() + strip * ledCount, ledCount, 1);
+    }
+}
+
+void LEDStripShadow::fill(uint32_t colour)
+{
+    std::fill(staged.begin(), staged.end(), colour);
+    std::fill(defined.begin(), defined.end(), 1);
+}
+
+bool LEDStripShadow::needs(unsigned strip, unsigned led, const uint32_t *under) const
+{
+    unsigned i = strip * ledCount + led;
+    if (!defined[i])
+        return false;
+    if (under)
+        return staged[i] != *under;
+    return !known[i] || staged[i] != shadow[i];
+}
+
+bool LEDStripShadow::allSet(unsigned first, unsigned count) const
+{
+    return std::all_of(defined.begin() + first, defined.begin() + first + count, [](uint8_t d) { return d; });
+}
+
+// One past the last LED of the range starting at led: as far as a message
+// reaches, but never over an LED that was not set and whose colour is not
+// known either, and trimmed back to the last LED that needs writing. Under a
+// fill every LED is set.
+unsigned LEDStripShadow::rangeEnd(unsigned strip, unsigned led, const uint32_t *under) const
+{
+    unsigned reach = std::min(led + LED_STRIP_CONFIG_MAX_COLOURS, ledCount);
+    unsigned end = led + 1;
+    while (end < reach && (defined[strip * ledCount + end] || known[strip * ledCount + end]))
+        end++;
+    while (!needs(strip, end - 1, under))
+        end--;
+    return end;
+}
+
+bool LEDStripShadow::stripChanged(unsigned strip) const
+{
+    for (unsigned led = 0; led < ledCount; led++)
+        if (needs(strip, led, nullptr))
+            return true;
+    return false;
+}
+
+// Greedy cover with fixed-length ranges is optimal: each range starts at the
+// first LED not yet covered.
+unsigned LEDStripShadow::ranges(unsigned strip, const uint32_t *under) const
+{
+    unsigned count = 0;
+    for (unsigned led = 0; led < ledCount; ) {
+        if (!needs(strip, led, under)) {
+            led++;
+            continue;
+        }
+        count++;
+        led = rangeEnd(strip, led, under);
+    }
+    return count;
+}
+
+void LEDStripShadow::emitRanges(unsigned strip, const uint32_t *under, std::vector<mavlink_led_strip_config_t> &out) const
+{
+    for (unsigned led = 0; led < ledCount; ) {
+        if (!needs(strip, led, under)) {
+            led++;
+            continue;
+        }
+
+        unsigned end = rangeEnd(strip, led, under);
+
+        mavlink_led_strip_config_t config = base;
+        memset(config.colors, 0, sizeof(config.colors));
+        config.fill_mode = LED_FILL_MODE_INDEX;
+        config.strip_id = strip;
+        config.led_index = led;
+        config.length = end - led;
+        // An LED in the middle that was never set keeps what it shows.
+        for (unsigned i = led; i < end; i++) {
+            unsigned at = strip * ledCount + i;
+            config.colors[i - led] = defined[at] ? staged[at] : shadow[at];
+        }
+        out.push_back(config);
+
+        led = end;
+    }
+}
+
+// Most common staged colour among count LEDs from first.
+uint32_t LEDStripShadow::dominant(unsigned first, unsigned count)
+{
+    scratch.assign(staged.begin() + first, staged.begin() + first + count);
+    std::sort(scratch.begin(), scratch.end());
+
+    uint32_t best = scratch[0];
+    size_t bestRun = 0;
+    for (size_t i = 0; i < scratch.size(); ) {
+        size_t j = i;
+        while (j < scratch.size() && scratch[j] == scratch[i])
+            j++;
+        if (j - i > bestRun) {
+            bestRun = j - i;
+            best = scratch[i];
+        }
+        i = j;
+    }
+    return best;
+}
+
+size_t LEDStripShadow::flush(std::vector<mavlink_led_strip_config_t> &out)
+{
+    size_t before = out.size();
+    if (staged.empty())
+        return 0;
+
+    // Option 1: every strip on its own, as INDEX ranges or a strip fill plus fixes.
+    std::vector<uint8_t> useFill(stripCount, 0);
+    std::vector<uint32_t> fillColour(stripCount, 0);
+    unsigned perStrip = 0;
+    bool changed = false;
+
+    for (unsigned strip = 0; strip < stripCount; strip++) {
+        if (!stripChanged(strip))
+            continue;
+        changed = true;
+
+        // A strip fill would also write any LED that was never set.
+        unsigned cost = ranges(strip, nullptr);
+        if (allSet(strip * ledCount, ledCount)) {
+            fillColour[strip] = dominant(strip * ledCount, ledCount);
+            unsigned withFill = 1 + ranges(strip, &fillColour[strip]);
+            useFill[strip] = withFill < cost;
+            cost = std::min(cost, withFill);
+        }
+        perStrip += cost;
+    }
+
+    if (!changed)
+        return 0;
+
+    // Option 2: one fill for the whole vehicle, then fixes on every strip.
+    uint32_t everywhere = 0;
+    bool global = allSet(0, staged.size());
+    unsigned globalCount = 1;
+    if (global) {
+        everywhere = dominant(0, staged.size());
+        for (unsigned strip = 0; strip < stripCount; strip++)
+            globalCount += ranges(strip, &everywhere);
+    }
+
+    mavlink_led_strip_config_t fill = base;
+    memset(fill.colors, 0, sizeof(fill.colors));
+    fill.fill_mode = LED_FILL_MODE_ALL;
+    fill.led_index = 0;
+    fill.length = 1;
+
+    if (global && globalCount < perStrip) {
+        fill.strip_id = UINT8_MAX;
+        fill.colors[0] = everywhere;
+        out.push_back(fill);
+        for (unsigned strip = 0; strip < stripCount; strip++)
+            emitRanges(strip, &everywhere, out);
+    } else {
+        for (unsigned strip = 0; strip < stripCount; strip++) {
+            if (!useFill[strip]) {
+                emitRanges(strip, nullptr, out);
+                continue;
+            }
+            fill.strip_id = strip;
+            fill.colors[0] = fillColour[strip];
+            out.push_back(fill);
+            emitRanges(strip, &fillColour[strip], out);
+        }
+    }
+
+    for (size_t i = before; i < out.size(); i++)
+        apply(out[i]);
+    return out.size() - before;
+}
+
+// What the server does with the message, done to the shadow.
+void LEDStripShadow::apply(const mavlink_led_strip_config_t &config)
+{
+    unsigned first = 0, last = stripCount - 1;
+    if (config.strip_id != UINT8_MAX)
+        first = last = config.strip_id;
+
+    for (unsigned strip = first; strip <= last; strip++) {
+        unsigned from = 0, count = ledCount;
+        if (config.fill_mode == LED_FILL_MODE_INDEX) {
+            from = config.led_index;
+            count = config.length;
+        }
+        for (unsigned led = from; led < from + count; led++) {
+            unsigned i = strip * ledCount + led;
+            shadow[i] = config.fill_mode == LED_FILL_MODE_INDEX ? config.colors[led - from] : config.colors[0];
+            known[i] = 1;
+        }
+    }
+}
+
+size_t LEDStripShadow::wireBytes(const mavlink_led_strip_config_t &config)
+{
+    // Wire order: colors[8], then the single-byte fields.
+    uint8_t payload[MAVLINK_MSG_ID_LED_STRIP_CONFIG_LEN];
+    memcpy(payload, config.colors, sizeof(config.colors));
+    payload[32] = config.target_system;
+    payload[33] = config.target_component;
+    payload[34] = config.fill_mode;
+    payload[35] = config.led_index;
+    payload[36] = config.length;
+    payload[37] = config.strip_id;
+
+    size_t len = sizeof(payload);
+    while (len > 1 && payload[len - 1] == 0)
+        len--;
+    return MAVLINK_NUM_NON_PAYLOAD_BYTES + len;
+}
@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "LED_Client.h"
+#include "LED_Shadow.h"
+#include "LED_Timeline.h"
+
+// Cache file: magic, version, then the hash of what it was compiled from and
+// the command count. Each command is 8 bytes (time, kind, RGB) and fades add
+// their duration.
+static const char TimelineMagic[4] = {'L', 'E', 'D', 'T'};
+#define TIMELINE_CACHE_VERSION 3
+#define TIMELINE_CACHE_HEADER 16
+#define TIMELINE_MAX_COMMANDS 1000000
+
+static void put32(std::string &out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+        out += (char)(value >> shift);
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static uint32_t blend(uint32_t from, uint32_t to, double fraction)
+{
+    uint32_t colour = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        int low = (from >> shift) & 0xFF, high = (to >> shift) & 0xFF;
+        colour |= (uint32_t)std::lround(low + (high - low) * fraction) << shift;
+    }
+    return colour;
+}
+
+// Largest channel difference: past that many samples a fade only repeats itself.
+static unsigned levels(uint32_t from, uint32_t to)
+{
+    unsigned most = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+        most = std::max(most, (unsigned)std::abs((int)((from >> shift) & 0xFF) - (int)((to >> shift) & 0xFF)));
+    return most;
+}
+
+bool LEDTimeline::parse(std::istream &in, const std::string &name)
+{
+    std::string line;
+    int lineNo = 0;
+
+    keyframes.clear();
+    while (std::getline(in, line)) {
+        lineNo++;
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string at, what, extra;
+        if (!(words >> at))
+            continue;
+
+        Keyframe key = {};
+        char *end;
+        long ms = strtol(at.c_str(), &end, 10);
+        long colour = 0;
+        bool valid = *end == '\0' && ms >= 0 && ms <= INT32_MAX && (words >> what);
+        if (valid && what == "follow") {
+            key.kind = Keyframe::Kind::Follow;
+        } else if (valid) {
+            colour = strtol(what.c_str(), &end, 16);
+            valid = *end == '\0' && colour >= 0 && colour <= 0xFFFFFF;
+            if (valid && (words >> extra)) {
+                valid = extra == "fade";
+                key.fade = true;
+            }
+        }
+        if (!valid || (words >> extra)) {
+            std::cerr << name << ":" << lineNo << ": invalid key: " << line << '\n';
+            return false;
+        }
+
+        key.atMs = ms;
+        key.colour = colour;
+        keyframes.push_back(key);
+    }
+
+    // Keys may be written in any order; the last written wins a tie.
+    std::stable_sort(keyframes.begin(), keyframes.end(),
+                     [](const Keyframe &a, const Keyframe &b) { return a.atMs < b.atMs; });
+    auto last = std::unique(keyframes.rbegin(), keyframes.rend(),
+                            [](const Keyframe &a, const Keyframe &b) { return a.atMs == b.atMs; });
+    keyframes.erase(keyframes.begin(), last.base());
+    return true;
+}
+
+void LEDTimeline::compile(bool vehicleFades, unsigned maxRateHz)
+{
+    // What the vehicle will be showing, as far as the schedule so far goes.
+    bool known = false;
+    Keyframe::Kind shownKind = Keyframe::Kind::Colour;
+    uint32_t shown = 0;
+
+    auto same = [&](const Keyframe &key) {
+        return known && shownKind == key.kind && (key.kind == Keyframe::Kind::Follow || shown == key.colour);
+    };
+
+    compiled.clear();
+    for (size_t i = 0; i < keyframes.size(); i++) {
+        const Keyframe &key = keyframes[i];
+        const Keyframe *previous = i ? &keyframes[i - 1] : nullptr;
+
+        if (same(key))
+            continue;
+
+        // Only a colour key has a colour to fade from; after a follow key the
+        // show holds the flight mode and cuts, with or without vehicle fades.
+        if (key.kind == Keyframe::Kind::Colour && key.fade && previous
+                && previous->kind == Keyframe::Kind::Colour) {
+            uint32_t duration = key.atMs - previous->atMs;
+            if (vehicleFades) {
+                compiled.push_back({previous->atMs, TimedCommand::Kind::Fade, key.colour, duration});
+            } else {
+                // Starts from the previous key's colour, which is showing by now.
+                uint32_t last = previous->colour;
+                unsigned steps = std::min<uint64_t>(levels(last, key.colour), (uint64_t)duration * maxRateHz / 1000);
+                steps = std::max(steps, 1u);
+                for (unsigned step = 1; step <= steps; step++) {
+                    uint32_t colour = blend(previous->colour, key.colour, (double)step / steps);
+                    if (colour == last)
+                        continue;
+                    compiled.push_back({previous->atMs + (uint32_t)((uint64_t)duration * step / steps),
+                                        TimedCommand::Kind::Colour, colour, 0});
+                    last = colour;
+                }
+            }
+        } else if (key.kind == Keyframe::Kind::Follow) {
+            compiled.push_back({key.atMs, TimedCommand::Kind::Follow, 0, 0});
+        } else {
+            compiled.push_back({key.atMs, TimedCommand::Kind::Colour, key.colour, 0});
+        }
+
+        known = true;
+        shownKind = key.kind;
+        shown = key.colour;
+    }
+    compiledHash = hash(vehicleFades, maxRateHz);
+}
+
+// FNV-1a over every key and the compile options.
+uint64_t LEDTimeline::hash(bool vehicleFades, unsigned maxRateHz) const
+{
+    std::string bytes;
+    for (const auto &key : keyframes) {
+        put32(bytes, key.atMs);
+        put32(bytes, key.colour);
+        bytes += (char)key.kind;
+        bytes += (char)key.fade;
+    }
+    bytes += (char)vehicleFades;
+    put32(bytes, maxRateHz);
+
+    uint64_t value = 14695981039346656037ULL;
+    for (unsigned char byte : bytes) {
+        value ^= byte;
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+bool LEDTimeline::saveCompiled(const std::string &path) const
+{
+    std::string out(TimelineMagic, sizeof(TimelineMagic));
+    put32(out, TIMELINE_CACHE_VERSION);
+    put32(out, (uint32_t)compiledHash);
+    put32(out, (uint32_t)(compiledHash >> 32));
+    put32(out, compiled.size());
+    for (const auto &command : compiled) {
+        put32(out, command.atMs);
+        put32(out, (uint32_t)command.kind | (command.colour & 0xFFFFFF) << 8);
+        if (command.kind == TimedCommand::Kind::Fade)
+            put32(out, command.durationMs);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    return file.write(out.data(), out.size()) && file.flush();
+}
+
+bool LEDTimeline::loadCompiled(const std::string &path, bool vehicleFades, unsigned maxRateHz)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < TIMELINE_CACHE_HEADER + 4 || memcmp(data.data(), TimelineMagic, sizeof(TimelineMagic)))
+        return false;
+
+    const uint8_t *in = (const uint8_t *)data.data() + sizeof(TimelineMagic);
+    const uint8_t *end = (const uint8_t *)data.data() + data.size();
+    uint64_t expected = hash(vehicleFades, maxRateHz);
+    if (get32(in) != TIMELINE_CACHE_VERSION || get32(in + 4) != (uint32_t)expected
+            || get32(in + 8) != (uint32_t)(expected >> 32))
+        return false;
+    uint32_t count = get32(in + 12);
+    in += TIMELINE_CACHE_HEADER;
+    if (count > TIMELINE_MAX_COMMANDS)
+        return false;
+
+    std::vector<TimedCommand> commands;
+    commands.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (end - in < 8)
+            return false;
+        uint32_t packed = get32(in + 4);
+        TimedCommand command = {get32(in), (TimedCommand::Kind)(packed & 0xFF), packed >> 8, 0};
+        in += 8;
+        if (command.kind > TimedCommand::Kind::Follow)
+            return false;
+        if (command.kind == TimedCommand::Kind::Fade) {
+            if (end - in < 4)
+                return false;
+            command.durationMs = get32(in);
+            in += 4;
+        }
+        commands.push_back(command);
+    }
+    if (in != end)
+        return false;
+
+    compiled.swap(commands);
+    compiledHash = expected;
+    return true;
+}
+
+mavlink_led_strip_config_t LEDTimeline::message(const TimedCommand &command, const mavlink_led_strip_config_t &base,
+                                                uint64_t showStartUs)
+{
+    mavlink_led_strip_config_t config = base;
+    std::fill(std::begin(config.colors), std::end(config.colors), 0);
+    config.strip_id = UINT8_MAX;
+    config.led_index = 0;
+    config.length = 1;
+
+    switch (command.kind) {
+    case TimedCommand::Kind::Colour:
+        setLEDFillColour(command.colour, config);
+        break;
+    case TimedCommand::Kind::Fade:
+        setLEDFade(command.colour, command.durationMs, config);
+        break;
+    case TimedCommand::Kind::Follow:
+        setFollowFlightMode(config);
+        break;
+    }
+    setLEDExecuteAt(showStartUs + command.atMs * 1000ULL, config);
+    return config;
+}
+
+TimelineCost LEDTimeline::cost(const mavlink_led_strip_config_t &base, uint64_t showStartUs) const
+{
+    TimelineCost total = {compiled.size(), 0};
+    for (const auto &command : compiled)
+        total.bytes += LEDStripShadow::wireBytes(message(command, base, showStartUs));
+    return total;
+}
+
+bool LEDTimeline::stateAt(uint32_t atMs, Keyframe::Kind &kind, uint32_t &colour) const
+{
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), atMs,
+                                 [](uint32_t ms, const Keyframe &key) { return ms < key.atMs; });
+    if (next == keyframes.begin())
+        return false;
+
+    const Keyframe &key = *(next - 1);
+    kind = key.kind;
+    colour = key.colour;
+    if (next != keyframes.end() && next->fade && next->kind == Keyframe::Kind::Colour
+            && key.kind == Keyframe::Kind::Colour)
+        colour = blend(key.colour, next->colour, (double)(atMs - key.atMs) / (next->atMs - key.atMs));
+    return true;
+}
+
+// Streaming sends the frame as it happens, so it needs no execute-at.
+TimelineCost LEDTimeline::naiveCost(const mavlink_led_strip_config_t &base, unsigned frameRateHz) const
+{
+    TimelineCost total = {0, 0};
+    mavlink_led_strip_config_t config = base;
+    uint64_t frames = (uint64_t)durationMs() * frameRateHz / 1000;
+
+    for (uint64_t frame = 0; frame <= frames; frame++) {
+        Keyframe::Kind kind;
+        uint32_t colour;
+        if (!stateAt(frame * 1000 / frameRateHz, kind, colour))
+            continue;
+
+        if (kind == Keyframe::Kind::Follow)
+            setFollowFlightMode(config);
+        else
+            setLEDFillColour(colour, config);
+        total.commands++;
+        total.bytes += LEDStripShadow::wireBytes(config);
+    }
+    return total;
+}
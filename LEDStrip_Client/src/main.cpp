@@ -10,6 +10,8 @@
 #include <mavsdk/mavsdk.h>
 #include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
 #include <mavsdk/plugins/telemetry/telemetry.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
@@ -18,6 +20,8 @@
 #include <thread>
 
 #include "LED_Client.h"
+#include "LED_Sender.h"
+#include "LEDStrip_Common/LEDStrip_Protocol.h"
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1900) && !defined(IMGUI_DISABLE_WIN32_FUNCTIONS)
 #pragma comment(lib, "legacy_stdio_definitions")
@@ -42,14 +46,35 @@ static ImGui_ImplVulkanH_Window g_MainWindowData;
 static int                      g_MinImageCount = 2;
 static bool                     g_SwapChainRebuild = false;
 
+// Idle handling: frames are only drawn for a few frames after something happens
+#define CLIENT_SETTLE_FRAMES    3       // ImGui needs a couple of frames to settle hover/release
+#define CLIENT_IDLE_TIMEOUT_S   1.0
+#define CLIENT_MAX_FRAME_RATE_HZ 60     // Holds without vsync (unlimited frame rate builds, minimised)
+static int                      g_FramesToDraw = CLIENT_SETTLE_FRAMES;
+static std::chrono::steady_clock::time_point g_NextFrameAt;
+static std::chrono::steady_clock::time_point g_InputAt;     // First event not yet on screen
+static uint64_t                 g_Frames = 0;
+static uint64_t                 g_InputFrames = 0;
+static double                   g_InputToFrameUsTotal = 0;
+
+// Latest LED status report from the vehicle, written by a MAVSDK thread
+static std::atomic<bool>        g_VehicleStateChanged{false};
+static std::atomic<uint32_t>    g_VehicleColour{0};
+static std::atomic<uint32_t>    g_VehicleApplied{0};
+static std::atomic<bool>        g_VehicleFollowing{false};
+static std::atomic<bool>        g_HaveVehicleState{false};
+
 void usage(const std::string &bin_name)
 {
-    std::cerr << "Usage : " << bin_name << " <connection_url>\n"
+    std::cerr << "Usage : " << bin_name << " <connection_url> [max_send_rate_hz]\n"
               << "Connection URL format should be :\n"
               << " For TCP : tcp://[server_host][:server_port]\n"
               << " For UDP : udp://[bind_host][:bind_port]\n"
               << " For Serial : serial:///path/to/serial/dev[:baudrate]\n"
-              << " For example, to connect to a local mavlink-router server use URL: tcp://127.0.0.1:5760"
+              << " For example, to connect to a local mavlink-router server use URL: tcp://127.0.0.1:5760\n"
+              << "LED commands are sent at most max_send_rate_hz times a second (default 20).\n"
+              << "On serial:// links they are also held to 10% of the baud rate, less\n"
+              << "while RADIO_STATUS reports the radio's transmit buffer filling up."
               << std::endl;
 }
 
@@ -360,6 +385,28 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
+static void request_frames(void)
+{
+    if (g_FramesToDraw == 0 && g_InputAt == std::chrono::steady_clock::time_point())
+        g_InputAt = std::chrono::steady_clock::now();
+    g_FramesToDraw = CLIENT_SETTLE_FRAMES;
+}
+
+// Installed before the ImGui backend, which chains to them, so any input or
+// window event wakes the loop for a few frames.
+static void install_wake_callbacks(GLFWwindow* window)
+{
+    glfwSetCursorPosCallback(window, [](GLFWwindow*, double, double) { request_frames(); });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow*, int, int, int) { request_frames(); });
+    glfwSetScrollCallback(window, [](GLFWwindow*, double, double) { request_frames(); });
+    glfwSetKeyCallback(window, [](GLFWwindow*, int, int, int, int) { request_frames(); });
+    glfwSetCharCallback(window, [](GLFWwindow*, unsigned int) { request_frames(); });
+    glfwSetCursorEnterCallback(window, [](GLFWwindow*, int) { request_frames(); });
+    glfwSetWindowFocusCallback(window, [](GLFWwindow*, int) { request_frames(); });
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow*, int, int) { request_frames(); });
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow*) { request_frames(); });
+}
+
 int main(int argc, char** argv)
 {
 
@@ -410,6 +457,7 @@ int main(int argc, char** argv)
     //ImGui::StyleColorsClassic();
 
     // Setup Platform/Renderer backends
+    install_wake_callbacks(window);
     ImGui_ImplGlfw_InitForVulkan(window, true);
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = g_Instance;
@@ -488,6 +536,23 @@ int main(int argc, char** argv)
     }
     
     auto mavlink_passthrough = mavsdk::MavlinkPassthrough{system.value()};
+    mavlink_led_strip_config_t LEDStripConfig = makeLEDStripConfig();
+    LEDStripSender sender{mavlink_passthrough, argc > 2 ? atof(argv[2]) : LED_SEND_MAX_RATE_HZ,
+                          linkBytesPerSecond(argv[1])};
+
+    // Status reports from LEDStrip_Server wake the UI to show them.
+    mavlink_passthrough.subscribe_message_async(LED_STRIP_CONFIG_MSG_ID, [](const mavlink_message_t &message) {
+        mavlink_led_strip_config_t status;
+        mavlink_msg_led_strip_config_decode(&message, &status);
+        if (!isLEDStatus(status))
+            return;
+        g_VehicleColour = status.colors[LED_STATUS_COLOUR_SLOT];
+        g_VehicleApplied = status.colors[LED_STATUS_APPLIED_COUNT_SLOT];
+        g_VehicleFollowing = status.fill_mode == LED_FILL_MODE_FOLLOW_FLIGHT_MODE;
+        g_HaveVehicleState = true;
+        g_VehicleStateChanged = true;
+        glfwPostEmptyEvent();
+    });
 
     ImVec4 ledColour = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
@@ -507,7 +572,24 @@ int main(int argc, char** argv)
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application, or clear/overwrite your copy of the mouse data.
         // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application, or clear/overwrite your copy of the keyboard data.
         // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-        glfwPollEvents();
+        // While nothing happens, sleep until an event or a vehicle status report arrives.
+        // Frames are capped here too: a minimised window presents nothing, so
+        // vsync can't pace it, and neither can the non-FIFO present modes.
+        if (g_FramesToDraw > 0)
+        {
+            std::this_thread::sleep_until(g_NextFrameAt);
+            g_NextFrameAt = std::max(g_NextFrameAt, std::chrono::steady_clock::now())
+                          + std::chrono::microseconds(1000000 / CLIENT_MAX_FRAME_RATE_HZ);
+            glfwPollEvents();
+        }
+        else
+            glfwWaitEventsTimeout(CLIENT_IDLE_TIMEOUT_S);
+
+        if (g_VehicleStateChanged.exchange(false))
+            request_frames();
+        if (g_FramesToDraw == 0)
+            continue;
+        g_FramesToDraw--;
 
         // Resize swap chain?
         if (g_SwapChainRebuild)
@@ -540,6 +622,15 @@ int main(int argc, char** argv)
             ImGui::ColorPicker3("LED Colour", (float*)&ledColour);
             ImGui::SameLine; ImGui::Checkbox("Follow Flight Mode", &followFlightMode);
 
+            if (g_HaveVehicleState)
+            {
+                if (g_VehicleFollowing)
+                    ImGui::Text("Vehicle: following flight mode");
+                else
+                    ImGui::Text("Vehicle: #%06X", (unsigned)(g_VehicleColour & 0xFFFFFF));
+                ImGui::Text("%u commands applied", (unsigned)g_VehicleApplied);
+            }
+
             ImGui::End();
         }
 
@@ -560,7 +651,7 @@ int main(int argc, char** argv)
                 if (oldColour != newColour)
                 {
                     setLEDFillColour(newColour, LEDStripConfig);
-                    sendLedStripConfig(mavlink_passthrough, LEDStripConfig);
+                    sender.send(LEDStripConfig);
                     followFlightModeSent = false;
                 }
             }
@@ -570,7 +661,7 @@ int main(int argc, char** argv)
                 if (!followFlightModeSent)
                 {
                     setFollowFlightMode(LEDStripConfig);
-                    sendLedStripConfig(mavlink_passthrough, LEDStripConfig);
+                    sender.send(LEDStripConfig, LEDStripSender::Priority::Urgent);
                     followFlightModeSent = true;
                     newColour = 0xFF000000;
                 }
@@ -578,11 +669,26 @@ int main(int argc, char** argv)
 
             FrameRender(wd, draw_data);
             FramePresent(wd);
-            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+            g_Frames++;
+            if (g_InputAt != std::chrono::steady_clock::time_point())
+            {
+                g_InputToFrameUsTotal += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - g_InputAt).count();
+                g_InputFrames++;
+                g_InputAt = std::chrono::steady_clock::time_point();
+            }
         }
     }
 
+    std::cout << "Drew " << std::dec << g_Frames << " frames, input to frame latency mean "
+              << (g_InputFrames ? g_InputToFrameUsTotal / g_InputFrames : 0) << "us" << std::endl;
+
+    std::cout << "Sent " << std::dec << sender.sentCount() << " LED commands (" << sender.droppedCount()
+              << " dropped), UI to send latency mean "
+              << sender.meanLatencyUs() << "us max " << sender.maxLatencyUs() << "us" << std::endl;
+
     // Cleanup
+    mavlink_passthrough.subscribe_message_async(LED_STRIP_CONFIG_MSG_ID, nullptr);
     err = vkDeviceWaitIdle(g_Device);
     check_vk_result(err);
     ImGui_ImplVulkan_Shutdown();
@@ -0,0 +1,104 @@
+// The shadow only counts an LED as known once a message it sent covered it.
+// Each flush is replayed onto a model vehicle whose LEDs start out holding a
+// colour the client never sent, and the result is checked LED by LED.
+#include <cstdio>
+#include <vector>
+
+#include "LED_Shadow.h"
+
+#define STRIPS 4
+#define LEDS 30
+#define UNSENT 0xDEAD00u        // What the vehicle shows before we send anything
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+struct Vehicle
+{
+    std::vector<uint32_t> leds = std::vector<uint32_t>(STRIPS * LEDS, UNSENT);
+
+    void apply(const std::vector<mavlink_led_strip_config_t> &messages)
+    {
+        for (const auto &m : messages) {
+            unsigned first = m.strip_id == UINT8_MAX ? 0 : m.strip_id;
+            unsigned last = m.strip_id == UINT8_MAX ? STRIPS - 1 : m.strip_id;
+            for (unsigned s = first; s <= last; s++) {
+                if (m.fill_mode == LED_FILL_MODE_ALL)
+                    for (unsigned i = 0; i < LEDS; i++)
+                        leds[s * LEDS + i] = m.colors[0];
+                else
+                    for (unsigned i = 0; i < m.length; i++)
+                        leds[s * LEDS + m.led_index + i] = m.colors[i];
+            }
+        }
+    }
+
+    uint32_t at(unsigned strip, unsigned led) const { return leds[strip * LEDS + led]; }
+};
+
+static std::vector<mavlink_led_strip_config_t> flush(LEDStripShadow &shadow, Vehicle &vehicle)
+{
+    std::vector<mavlink_led_strip_config_t> out;
+    shadow.flush(out);
+    vehicle.apply(out);
+    return out;
+}
+
+int main(void)
+{
+    mavlink_led_strip_config_t base = {};
+    LEDStripShadow shadow(STRIPS, LEDS, base);
+    Vehicle vehicle;
+
+    // Nothing set yet: nothing to send.
+    CHECK(flush(shadow, vehicle).empty());
+
+    // One strip filled: one strip fill, and no other strip is touched or known.
+    shadow.fillStrip(0, 0xFF0000);
+    auto out = flush(shadow, vehicle);
+    CHECK(out.size() == 1);
+    CHECK(out.size() == 1 && out[0].fill_mode == LED_FILL_MODE_ALL && out[0].strip_id == 0);
+    for (unsigned i = 0; i < LEDS; i++) {
+        CHECK(vehicle.at(0, i) == 0xFF0000 && shadow.shown(0, i));
+        CHECK(vehicle.at(1, i) == UNSENT && !shadow.shown(1, i));
+    }
+
+    // An edit on another strip sends just that LED, and only it becomes known.
+    shadow.set(1, 3, 0x00FF00);
+    out = flush(shadow, vehicle);
+    CHECK(out.size() == 1);
+    CHECK(out.size() == 1 && out[0].fill_mode == LED_FILL_MODE_INDEX && out[0].strip_id == 1
+            && out[0].led_index == 3 && out[0].length == 1);
+    CHECK(vehicle.at(1, 3) == 0x00FF00 && shadow.shown(1, 3));
+    CHECK(vehicle.at(1, 2) == UNSENT && !shadow.shown(1, 2));
+    CHECK(vehicle.at(1, 4) == UNSENT && !shadow.shown(1, 4));
+
+    // Set LEDs with an unknown one between them: the range must not cover it.
+    shadow.set(1, 5, 0x0000FF);
+    out = flush(shadow, vehicle);
+    CHECK(out.size() == 1);
+    CHECK(vehicle.at(1, 4) == UNSENT && vehicle.at(1, 5) == 0x0000FF);
+    shadow.set(2, 0, 0x0000FF);
+    shadow.set(2, 2, 0x0000FF);
+    out = flush(shadow, vehicle);
+    CHECK(out.size() == 2);
+    CHECK(vehicle.at(2, 1) == UNSENT);
+
+    // Filling the second strip reaches the LEDs that were still unknown.
+    shadow.fillStrip(1, 0xFFFFFF);
+    flush(shadow, vehicle);
+    for (unsigned i = 0; i < LEDS; i++)
+        CHECK(vehicle.at(1, i) == 0xFFFFFF && shadow.shown(1, i));
+
+    // After invalidate() everything set is sent again, and nothing else.
+    Vehicle followed;
+    shadow.invalidate();
+    flush(shadow, followed);
+    for (unsigned s = 0; s < STRIPS; s++)
+        for (unsigned i = 0; i < LEDS; i++)
+            CHECK(followed.at(s, i) == vehicle.at(s, i));
+    CHECK(flush(shadow, followed).empty());
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+// Conventions layered on top of LED_STRIP_CONFIG (msg id 60200) that are
+// shared by LEDStrip_Server and LEDStrip_Client.
+#pragma once
+
+#include <cstdint>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#define LED_STRIP_CONFIG_MSG_ID         60200
+#define LED_STRIP_CONFIG_MAX_COLOURS    8
+
+// Execute-At Timestamp
+// Colour slots past `length` are unused, so a command that carries at most
+// LED_EXECUTE_AT_MAX_LENGTH colours may put an execute-at time in the last two
+// slots: microseconds since the Unix epoch, in the timebase shared with the
+// autopilot (GPS/UTC via SYSTEM_TIME). Zero (the default) means "now".
+// Servers refuse times more than a few seconds from now, so slots 6 and 7
+// must be zero unless they hold a time.
+#define LED_EXECUTE_AT_LO_SLOT          6
+#define LED_EXECUTE_AT_HI_SLOT          7
+#define LED_EXECUTE_AT_MAX_LENGTH       6
+
+inline uint64_t getLEDExecuteAt(const mavlink_led_strip_config_t &config)
+{
+    if (config.length > LED_EXECUTE_AT_MAX_LENGTH)
+        return 0;
+
+    return (uint64_t)config.colors[LED_EXECUTE_AT_HI_SLOT] << 32
+         | config.colors[LED_EXECUTE_AT_LO_SLOT];
+}
+
+// Returns false if the command carries too many colours to fit a timestamp.
+inline bool setLEDExecuteAt(uint64_t unixUs, mavlink_led_strip_config_t &config)
+{
+    if (config.length > LED_EXECUTE_AT_MAX_LENGTH)
+        return false;
+
+    config.colors[LED_EXECUTE_AT_LO_SLOT] = (uint32_t)unixUs;
+    config.colors[LED_EXECUTE_AT_HI_SLOT] = (uint32_t)(unixUs >> 32);
+    return true;
+}
+
+// Fades
+// A vehicle-wide ALL fill (strip_id 255) with led_index LED_FADE_INDEX fades
+// from the colour shown now to colors[0], over colors[LED_FADE_DURATION_SLOT]
+// milliseconds. Servers without fades ignore led_index on ALL fills and show
+// colors[0] straight away. Fades leave room for an execute-at time.
+#define LED_FADE_INDEX                  0xFF
+#define LED_FADE_DURATION_SLOT          1
+#define LED_FADE_LENGTH                 2
+
+inline bool isLEDFade(const mavlink_led_strip_config_t &config)
+{
+    return config.fill_mode == LED_FILL_MODE_ALL && config.strip_id == UINT8_MAX
+        && config.led_index == LED_FADE_INDEX && config.length >= LED_FADE_LENGTH;
+}
+
+inline void setLEDFade(uint32_t colour, uint32_t durationMs, mavlink_led_strip_config_t &config)
+{
+    config.fill_mode = LED_FILL_MODE_ALL;
+    config.strip_id = UINT8_MAX;
+    config.led_index = LED_FADE_INDEX;
+    config.length = LED_FADE_LENGTH;
+    config.colors[0] = colour;
+    config.colors[LED_FADE_DURATION_SLOT] = durationMs;
+}
+
+// LED Status
+// The server reports what it is showing with an LED_STRIP_CONFIG of its own,
+// marked by strip_id LED_STATUS_STRIP_ID and addressed to whoever sent the
+// last applied command. Servers ignore incoming messages with this strip_id.
+// fill_mode is the active mode; the colour slots carry:
+#define LED_STATUS_STRIP_ID             0xFE
+#define LED_STATUS_COLOUR_SLOT          0   // Fill colour (manual or flight mode)
+#define LED_STATUS_EFFECT_SLOT          1   // LED_EFFECT_*
+#define LED_STATUS_FRAME_HASH_SLOT      2   // FNV-1a of the framebuffer
+#define LED_STATUS_LAST_COMMAND_SLOT    3   // sysid << 16 | compid << 8 | MAVLink seq
+#define LED_STATUS_APPLIED_COUNT_SLOT   4   // Commands applied since startup
+#define LED_STATUS_LENGTH               5
+
+#define LED_EFFECT_NONE                 0
+#define LED_EFFECT_GAUGE                1
+#define LED_EFFECT_SCRIPT               2   // User effect file on the server
+
+inline uint32_t packLEDCommandId(uint8_t sysid, uint8_t compid, uint8_t seq)
+{
+    return (uint32_t)sysid << 16 | (uint32_t)compid << 8 | seq;
+}
+
+inline bool isLEDStatus(const mavlink_led_strip_config_t &config)
+{
+    return config.strip_id == LED_STATUS_STRIP_ID;
+}
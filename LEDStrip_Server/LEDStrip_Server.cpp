@@ -13,6 +13,12 @@
 #include <iostream>
 #include <future>
 #include <map>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <sys/timerfd.h>
 
 #include <mavsdk/mavsdk.h>
 #include <mavsdk/plugins/action/action.h>
@@ -20,6 +26,21 @@
 #include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
 #include <ws2811.h>
 
+#include "LEDStrip_Common/LEDStrip_Protocol.h"
+#include "LED_Arbiter.h"
+#include "LED_Effect.h"
+#include "LED_EventLoop.h"
+#include "LED_FastPath.h"
+#include "LED_Gauge.h"
+#include "LED_Kernels.h"
+#include "LED_Metrics.h"
+#include "LED_Output.h"
+#include "LED_PowerLimiter.h"
+#include "LED_Scheduler.h"
+#include "LED_StateFile.h"
+#include "LED_Status.h"
+#include "LED_TimeSync.h"
+
 using namespace mavsdk;
 using std::chrono::seconds;
 using std::this_thread::sleep_for;
@@ -29,15 +50,21 @@ using std::this_thread::sleep_for;
 
 
 // Cmdline Defaults
-#define LEFT_ARM_CHANNEL        0
 #define LEFT_ARM_GPIO           12
-#define RIGHT_ARM_CHANNEL       1
 #define RIGHT_ARM_GPIO          13
 #define DMA                     10
 #define ARM_LENGTH              5
 #define ARM_COUNT               2
 #define STRIP_TYPE              WS2811_STRIP_GRB		// WS2812/SK6812RGB integrated chip+leds
 const char* ENDPOINT     =      "tcp://127.0.0.1:5760";
+#define LED_COMPONENT_ID        134
+#define ENDPOINT_PRIORITY       0
+#define ENDPOINT_STALE_MS       1000
+#define TIMESYNC_PERIOD_MS      1000
+#define EXECUTE_AT_MAX_AHEAD_MS 5000        // Further ahead would sit in the scheduler too long
+#define EXECUTE_AT_MAX_LATE_MS  5000        // Further behind is stale or garbage
+#define FADE_RATE_HZ            50
+#define POWER_RAMP_RATE_HZ      50      // Renders while limited brightness recovers
 
 // Colours
 #define RED						0x00FF0000
@@ -58,12 +85,59 @@ ws2811_led_t ArrayOfColours[] =
 	PURPLE,     PINK
 };
 
-static bool followingFlightMode;
+static bool followingFlightMode = true;
+static ws2811_led_t flightModeColour = WHITE;
+static ws2811_led_t manualColour;
+
+// Optional telemetry gauge, shown instead of the flight mode colour
+static bool gaugeEnabled;
+static Gauge gauge;
+static unsigned gaugeLevel;     // Event loop copy of gauge.level()
+static double gaugeRateHz = GAUGE_MAX_RATE_HZ;
+
+// Optional user effect (see LED_Effect.h), also instead of the flight mode colour
+static bool effectEnabled;
+static Effect effect;
+static double effectRateHz = EFFECT_DEFAULT_RATE_HZ;
+static int64_t effectStartNs;
+static std::atomic<float> effectBattery, effectAltitude, effectClimb;
+
+// Vehicle-wide fade in progress (LED_FADE_* in LEDStrip_Protocol.h), towards
+// manualColour from each LED as it was shown when the fade started
+static bool fading;
+static std::vector<ws2811_led_t> fadeFrom[OUTPUT_MAX_ARMS];
+static int64_t fadeStartNs, fadeDurationNs;
+static int fadeTimer = -1;
+
+// Brightness limiting to a current budget; fed by every framebuffer write
+static PowerLimiter powerLimiter;
+static int powerTimer = -1;
+static bool powerTimerArmed;
+static std::atomic<double> homeLatitude, homeLongitude;
+static std::atomic<bool> haveHome;
 LED_FILL_MODE led_fill_mode;
 
+// Commands are queued here by the MAVSDK callbacks and applied on the event loop
+static Scheduler scheduler;
+static std::atomic<uint8_t> vehicleSysid;   // The autopilot's; 0 until it is found
+static TimeSync timeSync;
+static unsigned pendingFrames;  // Frame requests since the last render
+
+// Status reports back to whoever sent the last applied command
+static double statusRateHz = STATUS_DEFAULT_RATE_HZ;
+static std::unique_ptr<StatusPublisher> statusPublisher;
+static LedSender lastSender;
+static uint32_t appliedCount;
+
 // Setup Signal Catchers. Set running = 0 on SIGINT/SIGTERM
 static uint8_t clearOnExit = 0;
-static uint8_t running = 1;
+static uint8_t logTiming = 0;
+static std::string metricsPath;
+
+// Survives restarts so the LEDs come back as they were
+static std::string statePath;
+static std::unique_ptr<StateFile> stateFile;
+static volatile sig_atomic_t running = 1;
 static void ctrl_c_handler(int signum)
 {
     running = 0;
@@ -75,33 +149,18 @@ static void setup_handlers(void)
 }
 
 
-// Setup WS2811. Assumes ARM_COUNT == 2
-// TODO: Dynamic Setup & multiple ws2811 objects based on ARM_COUNT
+// Strips, dealt out two per ws2811 instance (see LED_Output.h)
+static int armCount = ARM_COUNT;
+static int armLength = ARM_LENGTH;
 static ws2811_return_t DroneLightStatus;
-static ws2811_t DroneLights =
-{
-    .freq = WS2811_TARGET_FREQ,
-    .dmanum = DMA,
-    .channel =
-    {
-        [LEFT_ARM_CHANNEL] =
-        {
-            .gpionum = LEFT_ARM_GPIO,
-            .invert = 0,
-            .count = ARM_LENGTH,
-            .strip_type = STRIP_TYPE,
-            .brightness = 255,
-        },
-        [RIGHT_ARM_CHANNEL] =
-        {
-            .gpionum = RIGHT_ARM_GPIO,
-            .invert = 0,
-            .count = ARM_LENGTH,
-            .strip_type = STRIP_TYPE,
-            .brightness = 255,
-        },
-    },
-};
+static LedOutput DroneLights;
+
+// Whole-framebuffer kernels for this layout, picked once the layout is known
+static LayoutSize layout;
+static const LayoutKernels *kernels;
+static ws2811_led_t *ArmLeds[OUTPUT_MAX_ARMS];
+static std::vector<ws2811_led_t> gaugeRamp;     // Gauge colour of each LED
+static std::vector<int64_t> gaugeRampSums;      // Channel sum of the first n
 
 
 // Map FlightModes to LED Colours
@@ -124,12 +183,104 @@ std::map<Telemetry::FlightMode, ws2811_led_t> FlightMode2Colour {
 };
 
 
-std::string mavsdkEndpoint = ENDPOINT;
+// One Mavsdk instance per endpoint so every LED command can be attributed
+// to the link it arrived on, and arbitrated by that link's priority.
+struct Endpoint {
+	std::string url;
+	uint8_t priority;
+	int staleMs;
+	std::unique_ptr<Mavsdk> mavsdk;
+	std::shared_ptr<System> system;
+	std::unique_ptr<MavlinkPassthrough> mavlink_passthrough;
+	int source;
+	uint16_t fastPathPort;      // 0 unless LED commands bypass MAVSDK
+	uint16_t forwardPort;
+	std::unique_ptr<FastPath> fastPath;
+};
+static std::vector<Endpoint> endpoints;
+static Arbiter arbiter;
+
+// url[,priority[,stale_ms]]. URLs may contain ':' but never ','.
+bool parseEndpoint(const char *arg, Endpoint &endpoint)
+{
+	std::string spec = arg;
+	size_t comma = spec.find(',');
+
+	endpoint.url = spec.substr(0, comma);
+	endpoint.priority = ENDPOINT_PRIORITY;
+	endpoint.staleMs = ENDPOINT_STALE_MS;
+	endpoint.fastPathPort = 0;
+	if (endpoint.url.empty())
+		return false;
+	if (comma == std::string::npos)
+		return true;
+
+	char *end;
+	const char *field = spec.c_str() + comma + 1;
+	long priority = std::strtol(field, &end, 10);
+	if (end == field || priority < 0 || priority > UINT8_MAX)
+		return false;
+	endpoint.priority = priority;
+	if (*end == '\0')
+		return true;
+	if (*end != ',')
+		return false;
+
+	field = end + 1;
+	long staleMs = std::strtol(field, &end, 10);
+	if (end == field || *end != '\0' || staleMs < 0)
+		return false;
+	endpoint.staleMs = staleMs;
+	return true;
+}
+
+// port:forward_port[,priority[,stale_ms]]. MAVSDK gets udp://127.0.0.1:forward_port.
+bool parseFastPath(const char *arg, Endpoint &endpoint)
+{
+	char *end;
+	long port = std::strtol(arg, &end, 10);
+	if (end == arg || *end != ':' || port <= 0 || port > UINT16_MAX)
+		return false;
+
+	const char *field = end + 1;
+	long forwardPort = std::strtol(field, &end, 10);
+	if (end == field || (*end != '\0' && *end != ',') || forwardPort <= 0 || forwardPort > UINT16_MAX)
+		return false;
+
+	std::string spec = "udp://127.0.0.1:" + std::to_string(forwardPort) + end;
+	if (!parseEndpoint(spec.c_str(), endpoint))
+		return false;
+	endpoint.fastPathPort = port;
+	endpoint.forwardPort = forwardPort;
+	return true;
+}
+
+// Comma separated list of non-negative integers below limit.
+bool parseIntList(const char *arg, int limit, std::vector<int> &values)
+{
+	values.clear();
+	while (true) {
+		char *end;
+		long value = std::strtol(arg, &end, 10);
+		if (end == arg || value < 0 || value >= limit)
+			return false;
+		values.push_back(value);
+		if (*end == '\0')
+			return true;
+		if (*end != ',')
+			return false;
+		arg = end + 1;
+	}
+}
+
 // Parse Cmdline Options using getopt
-// TODO: Account for multiple ws2811 objects
-void parseargs(int argc, char **argv, ws2811_t *ws2811)
+void parseargs(int argc, char **argv)
 {
 	int index, opt;
+	int stripType = STRIP_TYPE;
+	const char *gaugeArg = nullptr;
+	const char *effectArg = nullptr;
+	std::vector<int> values;
 
 	static struct option longopts[] =
 	{
@@ -140,7 +291,16 @@ void parseargs(int argc, char **argv, ws2811_t *ws2811)
 		{"strip", required_argument, 0, 's'},
 		{"arms", required_argument, 0, 'a'},
 		{"length", required_argument, 0, 'l'},
+		{"simulate", no_argument, 0, 'n'},
 		{"endpoint", required_argument, 0, 'e'},
+		{"fast-path", required_argument, 0, 'f'},
+		{"metrics", required_argument, 0, 'm'},
+		{"gauge", required_argument, 0, 'G'},
+		{"effect", required_argument, 0, 'E'},
+		{"power", required_argument, 0, 'P'},
+		{"state", required_argument, 0, 'S'},
+		{"status-rate", required_argument, 0, 'r'},
+		{"timing", no_argument, 0, 't'},
 		{0, 0, 0, 0}
 	};
 
@@ -148,7 +308,7 @@ void parseargs(int argc, char **argv, ws2811_t *ws2811)
 	{
 
 		index = 0;
-		opt = getopt_long(argc, argv, "cd:g:hs:a:l:", longopts, &index);
+		opt = getopt_long(argc, argv, "cd:e:E:f:g:G:hs:a:l:m:nP:r:S:t", longopts, &index);
 
 		if (opt == -1)
 			break;
@@ -156,75 +316,158 @@ void parseargs(int argc, char **argv, ws2811_t *ws2811)
 		switch (opt)
 		{		
 		case 0:
+			break;
+
 		case 'a':
+			armCount = std::atoi(optarg);
+			if (armCount <= 0 || armCount > OUTPUT_MAX_ARMS) {
+				std::cerr << "invalid arms " << optarg << " (1 to " << OUTPUT_MAX_ARMS << ")\n";
+				std::exit(-1);
+			}
+			break;
+
 		case 'l':
+			armLength = std::atoi(optarg);
+			if (armLength <= 0) {
+				std::cerr << "invalid length " << optarg << "\n";
+				std::exit(-1);
+			}
+			break;
+
 		case 'g':
+			if (!parseIntList(optarg, 64, values) || !DroneLights.setGpios(values)) {
+				std::cerr << "invalid gpio " << optarg << "\n";
+				std::exit(-1);
+			}
+			break;
+
+		case 'n':
+			DroneLights.setSimulate(true);
 			break;
 
 		case 'h':
 			std::cerr << "Usage: " << argv[0] << "\n"
 				<< "-h (--help)     - this information\n"
 				<< "-s (--strip)    - strip type - rgb, grb, gbr, rgbw\n"
-				<< "-d (--dma)      - dma channel to use (default 10)\n"
-				<< "-g (--gpio)     - Comma seperated list of GPIO to use\n"
-				<< "                  (default 12,13 (PWM0/1))\n"
+				<< "-d (--dma)      - Comma seperated list of dma channels, one per\n"
+				<< "                  peripheral in the order -g first uses it;\n"
+				<< "                  missing ones follow on from the last (default 10)\n"
+				<< "-g (--gpio)     - Comma seperated list of GPIO to use, one per arm:\n"
+				<< "                  12 or 18 (PWM0), 13 or 19 (PWM1), 21 (PCM),\n"
+				<< "                  10 (SPI). Arms on the same GPIO are chained on\n"
+				<< "                  one strip; with fewer GPIOs than arms they are\n"
+				<< "                  shared out in order (default 12,13)\n"
 				<< "-c (--clear)    - clear matrix on exit.\n"
-				<< "-a (--arms)     - No. arms with LEDS attached.\n" 
-				<< "                  i.e No. of LED strips (default 2)\n"
+				<< "-a (--arms)     - No. arms with LEDS attached (default 2, max 16)\n"
 				<< "-l (--length)   - No. leds per arm (default 5)\n"
-				<< "-e (--endpoint) - mavlink endpoint to connect to"
-				<< "                  (default tcp://127.0.0.1:5760)";
+				<< "-n (--simulate) - no LED hardware; time frames as if it were there\n"
+				<< "-e (--endpoint) - mavlink endpoint to connect to, as\n"
+				<< "                  url[,priority[,stale_ms]]. Repeat for several\n"
+				<< "                  links; a higher priority link overrides lower\n"
+				<< "                  ones until it sends nothing for stale_ms.\n"
+				<< "                  (default tcp://127.0.0.1:5760,0,1000)\n"
+				<< "-f (--fast-path) - port:forward_port[,priority[,stale_ms]]\n"
+				<< "                  Own UDP port and decode LED commands directly;\n"
+				<< "                  everything else is relayed to MAVSDK on\n"
+				<< "                  127.0.0.1:forward_port. May be repeated.\n"
+				<< "-G (--gauge)    - show battery, altitude, climb or home distance\n"
+				<< "                  as a bar along each arm instead of the flight\n"
+				<< "                  mode colour, e.g. altitude,0,50 (default range\n"
+				<< "                  battery 0,1 altitude 0,120 climb -5,5 home 0,500)\n"
+				<< "-E (--effect)   - run the effect in this file instead of showing\n"
+				<< "                  the flight mode colour, as file[,rate_hz]\n"
+				<< "                  (default 100 Hz). See LED_Effect.h\n"
+				<< "-m (--metrics)  - serve Prometheus metrics on this Unix socket\n"
+				<< "-P (--power)    - current budget in mA, as strip[,total]; dims\n"
+				<< "                  brightness to stay under it (default no limit)\n"
+				<< "-r (--status-rate) - max LED status reports per second, sent\n"
+				<< "                  when the LEDs change; 0 disables (default 5)\n"
+				<< "-S (--state)    - keep the LED state in this file and restore it\n"
+				<< "                  on startup\n"
+				<< "-t (--timing)   - log when scheduled commands fire\n";
 			exit(-1);
 
 		case 'c':
 			clearOnExit=1;
 			break;
 
-		case 'd':
+		case 't':
+			logTiming=1;
+			break;
+
+		case 'm':
+			metricsPath = optarg;
+			break;
+
+		case 'S':
+			statePath = optarg;
+			break;
+
+		case 'r':
 			if (optarg) {
-				int dma = std::atoi(optarg);
-				if (dma < 14) {
-					ws2811->dmanum = dma;
-				} else {
-					std::cerr << "invalid dma " << dma << "\n";
-					std::exit (-1);
+				char *end;
+				statusRateHz = strtod(optarg, &end);
+				if (end == optarg || *end != '\0' || statusRateHz < 0) {
+					std::cerr << "invalid status rate " << optarg << "\n";
+					std::exit(-1);
 				}
 			}
 			break;
 
+		case 'P':
+			if (optarg) {
+				char *end;
+				float stripMa = strtof(optarg, &end);
+				float totalMa = (*end == ',') ? strtof(end + 1, &end) : 0;
+				if (*end != '\0' || stripMa < 0 || totalMa < 0) {
+					std::cerr << "invalid power budget " << optarg << "\n";
+					std::exit(-1);
+				}
+				powerLimiter.configure(stripMa, totalMa);
+			}
+			break;
+
+		case 'G':
+			// Parsed once the arm length is known
+			gaugeArg = optarg;
+			break;
+
+		case 'E':
+			effectArg = optarg;
+			break;
+
+		case 'd':
+			if (!parseIntList(optarg, 14, values) || !DroneLights.setDmas(values)) {
+				std::cerr << "invalid dma " << optarg << "\n";
+				std::exit (-1);
+			}
+			break;
+
 		case 's':
 			if (optarg) {
 				if (!strncasecmp("rgb", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_RGB;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_RGB;
+					stripType = WS2811_STRIP_RGB;
 				}
 				else if (!strncasecmp("rbg", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_RBG;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_RBG;
+					stripType = WS2811_STRIP_RBG;
 				}
 				else if (!strncasecmp("grb", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_GRB;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_GRB;
+					stripType = WS2811_STRIP_GRB;
 				}
 				else if (!strncasecmp("gbr", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_GBR;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_GBR;
+					stripType = WS2811_STRIP_GBR;
 				}
 				else if (!strncasecmp("brg", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_BRG;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_BRG;
+					stripType = WS2811_STRIP_BRG;
 				}
 				else if (!strncasecmp("bgr", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = WS2811_STRIP_BGR;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = WS2811_STRIP_BGR;
+					stripType = WS2811_STRIP_BGR;
 				}
 				else if (!strncasecmp("rgbw", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = SK6812_STRIP_RGBW;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = SK6812_STRIP_RGBW;
+					stripType = SK6812_STRIP_RGBW;
 				}
 				else if (!strncasecmp("grbw", optarg, 4)) {
-					ws2811->channel[LEFT_ARM_CHANNEL].strip_type = SK6812_STRIP_GRBW;
-					ws2811->channel[RIGHT_ARM_CHANNEL].strip_type = SK6812_STRIP_GRBW;
+					stripType = SK6812_STRIP_GRBW;
 				}
 				else {
 					std::cerr << "invalid strip " << optarg << "\n";
@@ -234,7 +477,20 @@ void parseargs(int argc, char **argv, ws2811_t *ws2811)
 			break;
 
 		case 'e':
-			mavsdkEndpoint = optarg;
+			endpoints.emplace_back();
+			if (endpoints.size() > ARBITER_MAX_SOURCES || !parseEndpoint(optarg, endpoints.back())) {
+				std::cerr << "invalid endpoint " << optarg << "\n";
+				std::exit(-1);
+			}
+			break;
+
+		case 'f':
+			endpoints.emplace_back();
+			if (endpoints.size() > ARBITER_MAX_SOURCES || !parseFastPath(optarg, endpoints.back())) {
+				std::cerr << "invalid fast path " << optarg << "\n";
+				std::exit(-1);
+			}
+			break;
 
 		case '?':
 			/* getopt_long already reported error? */
@@ -244,75 +500,648 @@ void parseargs(int argc, char **argv, ws2811_t *ws2811)
 			std::exit(-1);
 		}
 	}
+
+	if (endpoints.empty()) {
+		endpoints.emplace_back();
+		parseEndpoint(ENDPOINT, endpoints.back());
+	}
+
+	DroneLights.setLayout(armCount, armLength);
+	DroneLights.setStripType(stripType);
+
+	if (gaugeArg) {
+		if (!Gauge::parse(gaugeArg, gauge, armLength)) {
+			std::cerr << "invalid gauge " << gaugeArg << "\n";
+			std::exit(-1);
+		}
+		gaugeEnabled = true;
+	}
+
+	if (effectArg) {
+		if (gaugeArg) {
+			std::cerr << "-G and -E both replace the flight mode colour; give one\n";
+			std::exit(-1);
+		}
+
+		// A trailing ",rate" if it is a number; file names may hold commas.
+		std::string path = effectArg;
+		size_t comma = path.rfind(',');
+		if (comma != std::string::npos) {
+			char *end;
+			double rate = strtod(path.c_str() + comma + 1, &end);
+			if (end != path.c_str() + comma + 1 && *end == '\0') {
+				if (!(rate > 0 && rate <= 1000)) {
+					std::cerr << "invalid effect rate " << path.substr(comma + 1) << "\n";
+					std::exit(-1);
+				}
+				effectRateHz = rate;
+				path.resize(comma);
+			}
+		}
+
+		if (!effect.load(path)) {
+			std::cerr << "effect: " << effect.error() << "\n";
+			std::exit(-1);
+		}
+		std::cout << "Loaded effect " << path << ": " << effect.instructions() << " instructions, "
+				<< effect.registers() << " registers\n";
+		effectEnabled = true;
+		effectStartNs = monotonicNowNs();
+	}
 }
 
 
-inline void clearArms(void) {
-	for(int Arm = 0; Arm < ARM_COUNT; Arm++)
-		for(int Pos = 0; Pos < ARM_LENGTH; Pos++)
-			DroneLights.channel[Arm].leds[Pos] = (ws2811_led_t)0;
+// Framebuffer writes keep the power estimate current as they go.
+inline void setLed(int Arm, int Pos, ws2811_led_t Colour) {
+	ws2811_led_t &Led = DroneLights.leds(Arm)[Pos];
+	if (Led != Colour) {
+		powerLimiter.update(Arm, Led, Colour);
+		Led = Colour;
+	}
 }
 
 inline void fillArms(ws2811_led_t Colour) {
-	for(int Arm = 0; Arm < ARM_COUNT; Arm++)
-		for(int Pos = 0; Pos < ARM_LENGTH; Pos++)
-			DroneLights.channel[Arm].leds[Pos] = Colour;
+	kernels->fill(ArmLeds, layout, Colour);
+	for(int Arm = 0; Arm < armCount; Arm++)
+		powerLimiter.fill(Arm, Colour);
+}
+
+inline void clearArms(void) {
+	fillArms(0);
 }
 
 inline void fillArm(ws2811_led_t Colour, int Arm) {
-	for(int Pos; Pos < ARM_LENGTH; Pos++) {
-		DroneLights.channel[Arm].leds[Pos] = Colour;
+	kernels->fillArm(ArmLeds[Arm], layout, Colour);
+	powerLimiter.fill(Arm, Colour);
+}
+
+// Lights the first Level LEDs of every arm, graded low to high colour.
+inline void fillGauge(unsigned Level) {
+	Level = std::min<unsigned>(Level, armLength);
+	kernels->bar(ArmLeds, layout, gaugeRamp.data(), Level);
+	for(int Arm = 0; Arm < armCount; Arm++)
+		powerLimiter.set(Arm, gaugeRampSums[Level]);
+}
+
+// Called once the output is up and the layout can no longer change.
+void setupKernels() {
+	layout = LayoutSize{ (unsigned)armCount, (unsigned)armLength };
+	kernels = &layoutKernels(layout);
+	for(int Arm = 0; Arm < armCount; Arm++)
+		ArmLeds[Arm] = DroneLights.leds(Arm);
+
+	gaugeRamp.resize(armLength);
+	gaugeRampSums.assign(armLength + 1, 0);
+	for(int Pos = 0; Pos < armLength; Pos++) {
+		gaugeRamp[Pos] = gauge.colourAt(Pos);
+		gaugeRampSums[Pos + 1] = gaugeRampSums[Pos] + PowerLimiter::channelSum(gaugeRamp[Pos]);
 	}
 }
 
+// One frame of the user effect, at the current time and telemetry.
+void renderEffect() {
+	int64_t channelSums[OUTPUT_MAX_ARMS];
+
+	int64_t elapsedNs = (monotonicNowNs() - effectStartNs) % (EFFECT_TIME_WRAP_S * 1000000000LL);
+	effect.setInput(EffectInput::Time, elapsedNs / 1e9);
+	effect.setInput(EffectInput::Battery, effectBattery);
+	effect.setInput(EffectInput::Altitude, effectAltitude);
+	effect.setInput(EffectInput::Climb, effectClimb);
+	effect.setInput(EffectInput::ModeRed, ((flightModeColour >> 16) & 0xFF) / 255.0f);
+	effect.setInput(EffectInput::ModeGreen, ((flightModeColour >> 8) & 0xFF) / 255.0f);
+	effect.setInput(EffectInput::ModeBlue, (flightModeColour & 0xFF) / 255.0f);
+
+	effect.render(ArmLeds, layout, channelSums);
+	for(int Arm = 0; Arm < armCount; Arm++)
+		powerLimiter.set(Arm, channelSums[Arm]);
+}
+
+// What following the flight mode shows: the effect or gauge if there is one.
+inline void fillFollowLayer() {
+	if (effectEnabled)
+		renderEffect();
+	else if (gaugeEnabled)
+		fillGauge(gaugeLevel);
+	else
+		fillArms(flightModeColour);
+}
+
 inline void killLights() {
 		fillArms(RED);
-		ws2811_render(&DroneLights);
-		ws2811_fini(&DroneLights);
+		DroneLights.render();
+		DroneLights.fini();
+}
+
+// Brightness only comes back up on a render, so while the limiter is still
+// ramping a timer keeps rendering an unchanged framebuffer.
+void armPowerTimer(bool on) {
+	if (powerTimer < 0 || on == powerTimerArmed)
+		return;
+
+	struct itimerspec spec = {};
+	if (on) {
+		spec.it_interval.tv_nsec = 1000000000L / POWER_RAMP_RATE_HZ;
+		spec.it_value = spec.it_interval;
+	}
+	timerfd_settime(powerTimer, 0, &spec, nullptr);
+	powerTimerArmed = on;
+}
+
+inline void renderLights() {
+	if (powerLimiter.enabled()) {
+		uint8_t brightness[OUTPUT_MAX_STRIPS];
+		if (powerLimiter.compute(brightness, monotonicNowNs()))
+			metrics.powerLimitedFrames.add();
+		for(unsigned Strip = 0; Strip < DroneLights.strips(); Strip++)
+			DroneLights.channel(Strip).brightness = brightness[Strip];
+		metrics.powerEstimateMa.set(powerLimiter.estimateMa());
+		armPowerTimer(powerLimiter.ramping());
+	}
+
+	int64_t start = monotonicNowNs();
+	DroneLightStatus = DroneLights.render();
+	int64_t duration = monotonicNowNs() - start;
+
+	metrics.framesRendered.add();
+	metrics.renderNsTotal.add(duration);
+	metrics.renderNsLast.set(duration);
+	metrics.renderSpreadNsLast.set(DroneLights.lastSpreadNs());
+
+	if (DroneLightStatus != WS2811_SUCCESS)
+	{
+		metrics.renderFailures.add();
+		std::cerr << "ws2811_render failed: " 
+				<< ws2811_get_return_t_str(DroneLightStatus) << '\n';
+	}
+}
+
+// The framebuffer changed. Renders are deferred to flushFrame() so a burst
+// of changes handled together costs one render.
+inline void requestFrame() {
+	metrics.framesRequested.add();
+	pendingFrames++;
+}
+
+// FNV-1a over the framebuffer, so a GCS can tell two vehicles show the same.
+uint32_t frameHash() {
+	uint32_t hash = 2166136261u;
+	for(int Arm = 0; Arm < armCount; Arm++) {
+		const uint8_t *bytes = reinterpret_cast<const uint8_t *>(DroneLights.leds(Arm));
+		for(size_t i = 0; i < armLength * sizeof(ws2811_led_t); i++)
+			hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+void publishStatus() {
+	if (!statusPublisher)
+		return;
+
+	mavlink_led_strip_config_t status = {};
+	status.target_system = lastSender.sysid;
+	status.target_component = lastSender.compid;
+	status.strip_id = LED_STATUS_STRIP_ID;
+	status.length = LED_STATUS_LENGTH;
+	status.fill_mode = followingFlightMode ? LED_FILL_MODE_FOLLOW_FLIGHT_MODE : LED_FILL_MODE_ALL;
+	status.colors[LED_STATUS_COLOUR_SLOT] = followingFlightMode ? flightModeColour : manualColour;
+	status.colors[LED_STATUS_EFFECT_SLOT] = !followingFlightMode ? LED_EFFECT_NONE
+			: effectEnabled ? LED_EFFECT_SCRIPT : gaugeEnabled ? LED_EFFECT_GAUGE : LED_EFFECT_NONE;
+	status.colors[LED_STATUS_FRAME_HASH_SLOT] = frameHash();
+	status.colors[LED_STATUS_LAST_COMMAND_SLOT] = packLEDCommandId(lastSender.sysid, lastSender.compid, lastSender.seq);
+	status.colors[LED_STATUS_APPLIED_COUNT_SLOT] = appliedCount;
+	statusPublisher->update(status, monotonicNowNs());
+}
+
+inline void flushFrame() {
+	if (!pendingFrames)
+		return;
+	metrics.framesCoalesced.add(pendingFrames - 1);
+	pendingFrames = 0;
+	renderLights();
+	publishStatus();
+}
+
+inline void persistState() {
+	if (!stateFile)
+		return;
+
+	PersistedState state = {};
+	state.followingFlightMode = followingFlightMode;
+	state.gaugeLevel = gaugeLevel;
+	state.manualColour = manualColour;
+	state.flightModeColour = flightModeColour;
+	stateFile->save(state);
+}
+
+// Shows the last persisted state straight away, before any MAVLink traffic.
+void restoreState() {
+	int64_t start = monotonicNowNs();
+	PersistedState state;
+
+	stateFile = std::make_unique<StateFile>(statePath);
+	if (!stateFile->restore(state))
+		return;
+
+	followingFlightMode = state.followingFlightMode;
+	gaugeLevel = std::min<unsigned>(state.gaugeLevel, armLength);
+	manualColour = state.manualColour;
+	flightModeColour = state.flightModeColour;
+
+	if (followingFlightMode)
+		fillFollowLayer();
+	else
+		fillArms(manualColour);
+	requestFrame();
+	flushFrame();
+
+	std::cout << "Restored LED state in " << (monotonicNowNs() - start) / 1000 << "us\n";
+}
+
+// ALL fills the addressed strips with colors[0]. INDEX writes colors[0..length)
+// from led_index on. strip_id UINT8_MAX addresses every strip.
+void applyStripConfig(const mavlink_led_strip_config_t& config) {
+	int First = 0, Last = armCount - 1;
+	if (config.strip_id != UINT8_MAX) {
+		if (config.strip_id >= armCount)
+			return;
+		First = Last = config.strip_id;
+	}
+
+	if (config.fill_mode == LED_FILL_MODE::LED_FILL_MODE_INDEX) {
+		unsigned Length = std::min<unsigned>(config.length, LED_STRIP_CONFIG_MAX_COLOURS);
+		for(int Arm = First; Arm <= Last; Arm++)
+			for(unsigned i = 0; i < Length && config.led_index + i < (unsigned)armLength; i++)
+				setLed(Arm, config.led_index + i, config.colors[i]);
+		return;
+	}
+
+	// Only whole-vehicle fills are remembered as the manual colour. A fade
+	// leaves the framebuffer where it is and gets there on the fade timer.
+	if (config.strip_id == UINT8_MAX) {
+		manualColour = config.colors[0];
+		if (!fading)
+			fillArms(manualColour);
+		return;
+	}
+	fillArm(config.colors[0], First);
+}
+
+void armFadeTimer(bool on) {
+	struct itimerspec spec = {};
+	if (on) {
+		spec.it_interval.tv_nsec = 1000000000L / FADE_RATE_HZ;
+		spec.it_value = spec.it_interval;
+	}
+	timerfd_settime(fadeTimer, 0, &spec, nullptr);
+}
+
+// Starts from the framebuffer, so a gauge, an effect frame or a half-done
+// fade carries on smoothly rather than jumping to one colour first.
+void startFade(const mavlink_led_strip_config_t& config) {
+	for(int Arm = 0; Arm < armCount; Arm++)
+		fadeFrom[Arm].assign(ArmLeds[Arm], ArmLeds[Arm] + armLength);
+	fadeStartNs = monotonicNowNs();
+	fadeDurationNs = (int64_t)config.colors[LED_FADE_DURATION_SLOT] * 1000000;
+	fading = fadeTimer >= 0 && fadeDurationNs > 0;
+	if (fading)
+		armFadeTimer(true);
+}
+
+// Each byte of the colour (W included) from one end to the other.
+ws2811_led_t blendColour(ws2811_led_t from, ws2811_led_t to, double fraction) {
+	ws2811_led_t colour = 0;
+	for(int shift = 0; shift < 32; shift += 8) {
+		int low = (from >> shift) & 0xFF, high = (to >> shift) & 0xFF;
+		colour |= (ws2811_led_t)std::lround(low + (high - low) * fraction) << shift;
+	}
+	return colour;
+}
+
+// Fade timerfd handler.
+void stepFade() {
+	uint64_t expirations;
+	if (read(fadeTimer, &expirations, sizeof(expirations)) <= 0)
+		return;
+	if (!fading) {
+		armFadeTimer(false);
+		return;
+	}
+
+	double fraction = (double)(monotonicNowNs() - fadeStartNs) / fadeDurationNs;
+	if (fraction >= 1) {
+		fading = false;
+		fillArms(manualColour);
+	} else {
+		for(int Arm = 0; Arm < armCount; Arm++)
+			for(int i = 0; i < armLength; i++)
+				setLed(Arm, i, blendColour(fadeFrom[Arm][i], manualColour, fraction));
+	}
+	requestFrame();
+	flushFrame();
+}
+
+// Power ramp timerfd handler: rerender so brightness keeps recovering. The
+// render disarms the timer once the limiter has caught up.
+void stepPowerRamp() {
+	uint64_t expirations;
+	if (read(powerTimer, &expirations, sizeof(expirations)) <= 0)
+		return;
+	requestFrame();
+	flushFrame();
+}
+
+// Runs on the event loop. Only updates the framebuffer; the caller renders.
+void applyCommand(const LedCommand& command) {
+	switch (command.kind)
+	{
+	case LedCommand::Kind::FlightModeColour:
+		flightModeColour = command.flightModeColour;
+		// The effect picks the new colour up on its next frame
+		if (!followingFlightMode || gaugeEnabled || effectEnabled)
+			return;
+		fillArms(flightModeColour);
+		break;
+
+	case LedCommand::Kind::GaugeLevel:
+		gaugeLevel = command.gaugeLevel;
+		if (!followingFlightMode)
+			return;
+		fillGauge(gaugeLevel);
+		break;
+
+	case LedCommand::Kind::StripConfig:
+		lastSender = command.sender;
+		appliedCount++;
+		// Any command ends a fade; a new fade starts from what is shown now
+		fading = false;
+		if (isLEDFade(command.config))
+			startFade(command.config);
+
+		if (command.config.fill_mode == LED_FILL_MODE::LED_FILL_MODE_FOLLOW_FLIGHT_MODE)
+		{
+			followingFlightMode = true;
+			fillFollowLayer();
+			break;
+		}
+
+		followingFlightMode = false;
+		applyStripConfig(command.config);
+		break;
+	}
+
+	metrics.followingFlightMode.set(followingFlightMode);
+	metrics.colour.set(followingFlightMode ? flightModeColour : manualColour);
+	persistState();
+	requestFrame();
+}
+
+// Timerfd handler: apply everything that is due, then render once.
+void fireDueCommands() {
+	ScheduledCommand due;
+
+	scheduler.acknowledge();
+	int64_t now = monotonicNowNs();
+
+	while (scheduler.popDue(now, due)) {
+		applyCommand(due.command);
+
+		if (logTiming && getLEDExecuteAt(due.command.config)) {
+			std::cout << "Fired command due " << timeSync.localToSharedUs(due.dueNs)
+					<< "us at monotonic " << now << "ns (late "
+					<< (now - due.dueNs) / 1000 << "us"
+					<< (timeSync.synced() ? ")\n" : ", unsynced)\n");
+		}
+	}
+
+	metrics.queueDepth.set(scheduler.depth());
+	flushFrame();
+}
+
+void queueCommand(const LedCommand& command, int64_t dueNs, bool timed = false) {
+	if (!scheduler.post(command, dueNs, timed)) {
+		metrics.commandsDropped.add();
+		std::cerr << "LED command queue full, dropping command\n";
+	}
+	metrics.queueDepth.set(scheduler.depth());
+}
+
+// Converts an execute-at time to a local deadline. Times outside the window
+// around now are refused and counted: they would hold a scheduler slot for
+// hours, or are leftover bytes from a client that never meant a time.
+bool executeAtDeadline(uint64_t executeAt, int64_t& dueNs) {
+	int64_t now = monotonicNowNs();
+	dueNs = timeSync.sharedToLocalNs(executeAt);
+	if (dueNs > now + EXECUTE_AT_MAX_AHEAD_MS * 1000000LL || dueNs < now - EXECUTE_AT_MAX_LATE_MS * 1000000LL) {
+		metrics.executeAtRejected.add();
+		return false;
+	}
+	return true;
+}
+
+// Commands for other vehicles or components, e.g. fleet copies for the
+// neighbours behind a shared radio. 0 is broadcast; until the autopilot is
+// found any system is taken to be ours.
+bool addressedToUs(const mavlink_led_strip_config_t& config) {
+	uint8_t sysid = vehicleSysid.load(std::memory_order_relaxed);
+	return (config.target_system == 0 || sysid == 0 || config.target_system == sysid)
+		&& (config.target_component == 0 || config.target_component == LED_COMPONENT_ID);
+}
+
+// Fast path handler, already on the event loop. Immediate commands skip the
+// scheduler and go straight into the framebuffer.
+void handleFastPathCommand(const mavlink_led_strip_config_t& config, const LedSender& sender, unsigned source) {
+	// Another server's report, not a command
+	if (isLEDStatus(config))
+		return;
+	if (!addressedToUs(config)) {
+		metrics.messagesNotForUs.add();
+		return;
+	}
+
+	metrics.messagesReceived[source].add();
+	if (!arbiter.accept(source, monotonicNowNs())) {
+		metrics.messagesOverridden[source].add();
+		return;
+	}
+
+	LedCommand command = {};
+	command.kind = LedCommand::Kind::StripConfig;
+	command.config = config;
+	command.sender = sender;
+
+	uint64_t executeAt = getLEDExecuteAt(config);
+	if (executeAt) {
+		int64_t dueNs;
+		if (executeAtDeadline(executeAt, dueNs))
+			queueCommand(command, dueNs, true);
+		return;
+	}
+
+	applyCommand(command);
 }
 
 void subscribe_flight_mode(Telemetry& telemetry){
-	followingFlightMode = true;
     telemetry.subscribe_flight_mode([](Telemetry::FlightMode flight_mode) {
-		if (followingFlightMode) {
-			auto Colour = FlightMode2Colour[flight_mode];
-			fillArms(Colour);
-			if ((DroneLightStatus = ws2811_render(&DroneLights)) != WS2811_SUCCESS)
-			{
-				std::cerr << "ws2811_render failed: " 
-						<< ws2811_get_return_t_str(DroneLightStatus) << '\n';
-			}
-		}
+		LedCommand command = {};
+		command.kind = LedCommand::Kind::FlightModeColour;
+		command.flightModeColour = FlightMode2Colour[flight_mode];
+		queueCommand(command, monotonicNowNs());
     });
 }
 
-void subscribe_led_string_config(MavlinkPassthrough& mavlink_passthrough, Telemetry& telemetry){
-	uint32_t *leds;
-    mavlink_passthrough.subscribe_message_async(
-		60200,
-        [&leds, &telemetry](const mavlink_message_t& msg) {
+// Telemetry thread. Returns a new telemetry rate when the gauge wants one.
+double gauge_sample(float value) {
+	if (gauge.sample(value, monotonicNowNs())) {
+		LedCommand command = {};
+		command.kind = LedCommand::Kind::GaugeLevel;
+		command.gaugeLevel = gauge.level();
+		queueCommand(command, monotonicNowNs());
+	}
+
+	double rate = gauge.suggestedRateHz();
+	if (rate > gaugeRateHz * 1.5 || rate < gaugeRateHz / 1.5) {
+		gaugeRateHz = rate;
+		return rate;
+	}
+	return 0;
+}
+
+// Subscribes to just the telemetry the gauge needs, starting at the maximum
+// rate and backing off while the value holds steady.
+void subscribe_gauge(Telemetry& telemetry){
+	auto ignore = [](Telemetry::Result) {};
+
+	switch (gauge.source())
+	{
+	case Gauge::Source::Battery:
+		telemetry.set_rate_battery_async(gaugeRateHz, ignore);
+		telemetry.subscribe_battery([&telemetry, ignore](Telemetry::Battery battery) {
+			if (double rate = gauge_sample(battery.remaining_percent))
+				telemetry.set_rate_battery_async(rate, ignore);
+		});
+		break;
+
+	case Gauge::Source::Altitude:
+		telemetry.set_rate_position_async(gaugeRateHz, ignore);
+		telemetry.subscribe_position([&telemetry, ignore](Telemetry::Position position) {
+			if (double rate = gauge_sample(position.relative_altitude_m))
+				telemetry.set_rate_position_async(rate, ignore);
+		});
+		break;
 
-			LED_FILL_MODE led_fill_mode = static_cast<LED_FILL_MODE>(mavlink_msg_led_strip_config_get_fill_mode(&msg));
-			if (led_fill_mode == LED_FILL_MODE::LED_FILL_MODE_FOLLOW_FLIGHT_MODE)
-			{
-				followingFlightMode = true;
+	case Gauge::Source::ClimbRate:
+		telemetry.set_rate_velocity_ned_async(gaugeRateHz, ignore);
+		telemetry.subscribe_velocity_ned([&telemetry, ignore](Telemetry::VelocityNed velocity) {
+			if (double rate = gauge_sample(-velocity.down_m_s))
+				telemetry.set_rate_velocity_ned_async(rate, ignore);
+		});
+		break;
+
+	case Gauge::Source::HomeDistance:
+		telemetry.subscribe_home([](Telemetry::Position home) {
+			homeLatitude = home.latitude_deg;
+			homeLongitude = home.longitude_deg;
+			haveHome = true;
+		});
+		telemetry.set_rate_position_async(gaugeRateHz, ignore);
+		telemetry.subscribe_position([&telemetry, ignore](Telemetry::Position position) {
+			if (!haveHome)
 				return;
-			}
+			// Equirectangular is plenty at gauge ranges.
+			const double EarthRadius = 6371000.0, Rad = M_PI / 180.0;
+			double north = (position.latitude_deg - homeLatitude) * Rad * EarthRadius;
+			double east = (position.longitude_deg - homeLongitude) * Rad * EarthRadius
+					* std::cos(homeLatitude * Rad);
+			if (double rate = gauge_sample(std::hypot(north, east)))
+				telemetry.set_rate_position_async(rate, ignore);
+		});
+		break;
+	}
+}
+
+// Only the telemetry the effect reads, at a fixed modest rate.
+void subscribe_effect_inputs(Telemetry& telemetry){
+	auto ignore = [](Telemetry::Result) {};
+
+	if (effect.uses(EffectInput::Battery)) {
+		telemetry.set_rate_battery_async(EFFECT_TELEMETRY_RATE_HZ, ignore);
+		telemetry.subscribe_battery([](Telemetry::Battery battery) {
+			effectBattery = battery.remaining_percent;
+		});
+	}
+	if (effect.uses(EffectInput::Altitude)) {
+		telemetry.set_rate_position_async(EFFECT_TELEMETRY_RATE_HZ, ignore);
+		telemetry.subscribe_position([](Telemetry::Position position) {
+			effectAltitude = position.relative_altitude_m;
+		});
+	}
+	if (effect.uses(EffectInput::Climb)) {
+		telemetry.set_rate_velocity_ned_async(EFFECT_TELEMETRY_RATE_HZ, ignore);
+		telemetry.subscribe_velocity_ned([](Telemetry::VelocityNed velocity) {
+			effectClimb = -velocity.down_m_s;
+		});
+	}
+}
 
-			followingFlightMode = false;
+void subscribe_led_string_config(MavlinkPassthrough& mavlink_passthrough, unsigned source){
+    mavlink_passthrough.subscribe_message_async(
+		LED_STRIP_CONFIG_MSG_ID,
+        [source](const mavlink_message_t& msg) {
+			LedCommand command = {};
+			command.kind = LedCommand::Kind::StripConfig;
+			command.sender = LedSender{ msg.sysid, msg.compid, msg.seq };
+			mavlink_msg_led_strip_config_decode(&msg, &command.config);
+			if (isLEDStatus(command.config))
+				return;
+			if (!addressedToUs(command.config)) {
+				metrics.messagesNotForUs.add();
+				return;
+			}
 
-			mavlink_msg_led_strip_config_get_colors(&msg, leds);
-			fillArms(leds[0]);
-			if ((DroneLightStatus = ws2811_render(&DroneLights)) != WS2811_SUCCESS)
-			{
-				std::cerr << "ws2811_render failed: " 
-						<< ws2811_get_return_t_str(DroneLightStatus) << '\n';
+			metrics.messagesReceived[source].add();
+			if (!arbiter.accept(source, monotonicNowNs())) {
+				metrics.messagesOverridden[source].add();
+				return;
 			}
+
+			// Commands with an execute-at time wait for it in the shared timebase
+			uint64_t executeAt = getLEDExecuteAt(command.config);
+			int64_t dueNs = monotonicNowNs();
+			if (executeAt && !executeAtDeadline(executeAt, dueNs))
+				return;
+			queueCommand(command, dueNs, executeAt != 0);
         }
     );
 }
 
-std::shared_ptr<System> get_system(Mavsdk& mavsdk)
+void subscribe_time_sync(MavlinkPassthrough& mavlink_passthrough){
+	mavlink_passthrough.subscribe_message_async(
+		MAVLINK_MSG_ID_TIMESYNC,
+		[](const mavlink_message_t& msg) { timeSync.handleTimesync(msg); }
+	);
+	mavlink_passthrough.subscribe_message_async(
+		MAVLINK_MSG_ID_SYSTEM_TIME,
+		[](const mavlink_message_t& msg) { timeSync.handleSystemTime(msg); }
+	);
+}
+
+// Periodic timerfd; returns -1 on failure.
+int create_periodic_timer(int periodMs) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct itimerspec spec = {};
+	spec.it_interval.tv_sec = periodMs / 1000;
+	spec.it_interval.tv_nsec = (periodMs % 1000) * 1000000L;
+	spec.it_value = spec.it_interval;
+	timerfd_settime(fd, 0, &spec, nullptr);
+	return fd;
+}
+
+// Keeps the event loop running while waiting, so fast path relays keep
+// flowing and commands keep being applied during discovery.
+std::shared_ptr<System> get_system(Mavsdk& mavsdk, EventLoop& loop)
 {
     std::cout << "Waiting to discover system...\n";
     auto promise_system = std::promise<std::shared_ptr<System>>{};
@@ -329,8 +1158,13 @@ std::shared_ptr<System> get_system(Mavsdk& mavsdk)
         }
     });
 
-    if (future_system.wait_for(seconds(3)) == std::future_status::timeout) {
-        bool not_found;
+    auto deadline = std::chrono::steady_clock::now() + seconds(3);
+    while (future_system.wait_for(seconds(0)) == std::future_status::timeout
+            && std::chrono::steady_clock::now() < deadline)
+        loop.poll(50);
+
+    if (future_system.wait_for(seconds(0)) == std::future_status::timeout) {
+        bool not_found = true;
         mavsdk.subscribe_on_new_system(nullptr);
 
         std::cerr << "No autopilot caught. Re-checking found systems once.\n";
@@ -350,58 +1184,170 @@ std::shared_ptr<System> get_system(Mavsdk& mavsdk)
 
 int main(int argc, char *argv[])
 {
-    parseargs(argc, argv, &DroneLights);
+    DroneLights.setGpios({ LEFT_ARM_GPIO, RIGHT_ARM_GPIO });
+    DroneLights.setDmas({ DMA });
+    parseargs(argc, argv);
 
 	ws2811_led_t Colour;
 	int i = 0;
 
 
-    if ((DroneLightStatus = ws2811_init(&DroneLights)) != WS2811_SUCCESS)
+    if ((DroneLightStatus = DroneLights.init()) != WS2811_SUCCESS)
     {
         std::cerr << "ws2811_init failed: " 
 		          << ws2811_get_return_t_str(DroneLightStatus) << "\n";
         return DroneLightStatus;
     }
 
-	Mavsdk mavsdk;
-	Mavsdk::Configuration config(1, 134, true);
-	mavsdk.set_configuration(config);
-    
-    ConnectionResult connection_result = mavsdk.add_any_connection(mavsdkEndpoint);
+	for(unsigned Strip = 0; Strip < DroneLights.strips(); Strip++)
+		powerLimiter.setStrip(Strip, currentModelFor(DroneLights.channel(Strip).strip_type),
+				DroneLights.channel(Strip).brightness);
+	for(int Arm = 0; Arm < armCount; Arm++)
+		powerLimiter.setSegment(Arm, DroneLights.stripOf(Arm), armLength);
+	setupKernels();
+	std::cout << armCount << " arms of " << armLength << " LEDs on " << DroneLights.strips()
+			<< " strip(s), " << DroneLights.instances() << " ws2811 instance(s)" << (DroneLights.simulate() ? ", simulated" : "")
+			<< ", " << kernels->name << " kernels\n";
+	clearArms();
+	if (!statePath.empty())
+		restoreState();
 
-    if (connection_result != ConnectionResult::Success) {
-        std::cerr << "Connection failed: " << connection_result << '\n';
-		killLights();
-		return -1;
+	EventLoop loop;
+	loop.add(scheduler.fd(), fireDueCommands);
+
+	fadeTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fadeTimer >= 0)
+		loop.add(fadeTimer, stepFade);
+
+	if (powerLimiter.enabled()) {
+		powerTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (powerTimer >= 0)
+			loop.add(powerTimer, stepPowerRamp);
+	}
+
+	// The effect animates on its own timer while the flight mode layer shows.
+	int effectTimer = -1;
+	if (effectEnabled) {
+		effectTimer = create_periodic_timer(std::max(1, (int)std::lround(1000 / effectRateHz)));
+		loop.add(effectTimer, [effectTimer]() {
+			uint64_t expirations;
+			if (read(effectTimer, &expirations, sizeof(expirations)) <= 0 || !followingFlightMode)
+				return;
+			renderEffect();
+			requestFrame();
+			flushFrame();
+		});
+	}
+
+	std::unique_ptr<MetricsServer> metricsServer;
+	if (!metricsPath.empty()) {
+		metricsServer = std::make_unique<MetricsServer>(metricsPath);
+		if (metricsServer->ok())
+			loop.add(metricsServer->fd(), [&metricsServer]() { metricsServer->serve(arbiter.count()); });
 	}
 
-	std::cout << "Mavlink Connection Established: " << mavsdkEndpoint << '\n';
+	// Connect every endpoint. The first with an autopilot provides telemetry.
+	Endpoint *primary = nullptr;
+	for (auto &endpoint : endpoints) {
+		endpoint.source = arbiter.addSource(endpoint.priority, endpoint.staleMs * 1000000LL);
+
+		if (endpoint.fastPathPort) {
+			endpoint.fastPath = std::make_unique<FastPath>(endpoint.fastPathPort, endpoint.forwardPort,
+					endpoint.source, handleFastPathCommand);
+			if (!endpoint.fastPath->ok())
+				continue;
+
+			FastPath *fastPath = endpoint.fastPath.get();
+			loop.add(fastPath->fd(), [fastPath]() {
+				fastPath->receive();
+				flushFrame();
+			});
+			loop.add(fastPath->forwardingFd(), [fastPath]() { fastPath->relayReplies(); });
+			std::cout << "LED fast path on UDP port " << endpoint.fastPathPort << '\n';
+		}
+
+		endpoint.mavsdk = std::make_unique<Mavsdk>();
+		endpoint.mavsdk->set_configuration(Mavsdk::Configuration(1, LED_COMPONENT_ID, true));
 
-    auto system = get_system(mavsdk);
-    if (!system) {
-        std::cerr << "No autopilot found\n";
+		ConnectionResult connection_result = endpoint.mavsdk->add_any_connection(endpoint.url);
+		if (connection_result != ConnectionResult::Success) {
+			std::cerr << "Connection failed: " << endpoint.url << ": " << connection_result << '\n';
+			continue;
+		}
+
+		std::cout << "Mavlink Connection Established: " << endpoint.url
+				<< " (priority " << (int)endpoint.priority << ")\n";
+
+		if (!(endpoint.system = get_system(*endpoint.mavsdk, loop))) {
+			std::cerr << "No autopilot found on " << endpoint.url << '\n';
+			continue;
+		}
+
+		endpoint.mavlink_passthrough = std::make_unique<MavlinkPassthrough>(endpoint.system);
+		if (!primary) {
+			primary = &endpoint;
+			vehicleSysid = endpoint.system->get_system_id();
+		}
+	}
+
+	if (!primary) {
+		std::cerr << "No autopilot found\n";
 		killLights();
-		return -1;  
+		return -1;
 	}
 
     setup_handlers();
-	clearArms();
 
     // Instantiate plugins.
-    auto telemetry = Telemetry{system};
-	auto mavlink_passthrough = MavlinkPassthrough{system};
+    auto telemetry = Telemetry{primary->system};
+	auto &mavlink_passthrough = *primary->mavlink_passthrough;
 
     subscribe_flight_mode(telemetry);
-	subscribe_led_string_config(mavlink_passthrough, telemetry);
+	if (gaugeEnabled)
+		subscribe_gauge(telemetry);
+	if (effectEnabled)
+		subscribe_effect_inputs(telemetry);
+	subscribe_time_sync(mavlink_passthrough);
+
+	for (auto &endpoint : endpoints) {
+		if (!endpoint.mavlink_passthrough)
+			continue;
+		subscribe_led_string_config(*endpoint.mavlink_passthrough, endpoint.source);
+	}
+
+	if (statusRateHz > 0) {
+		statusPublisher = std::make_unique<StatusPublisher>(statusRateHz);
+		for (auto &endpoint : endpoints)
+			if (endpoint.mavlink_passthrough)
+				statusPublisher->addLink(*endpoint.mavlink_passthrough);
+		if (statusPublisher->ok())
+			loop.add(statusPublisher->fd(), []() { statusPublisher->expire(monotonicNowNs()); });
+		else
+			statusPublisher.reset();
+	}
+
+	int timesyncTimer = create_periodic_timer(TIMESYNC_PERIOD_MS);
+	loop.add(timesyncTimer, [timesyncTimer, &mavlink_passthrough]() {
+		uint64_t expirations;
+		if (read(timesyncTimer, &expirations, sizeof(expirations)) > 0)
+			timeSync.request(mavlink_passthrough);
+	});
 
-    while (running) { }
+    loop.run(running);
+	close(timesyncTimer);
+	if (effectTimer >= 0)
+		close(effectTimer);
+	if (fadeTimer >= 0)
+		close(fadeTimer);
+	if (powerTimer >= 0)
+		close(powerTimer);
 
     if (clearOnExit) {
 	clearArms();
-	ws2811_render(&DroneLights);
+	DroneLights.render();
     }
 
-    ws2811_fini(&DroneLights);
+    DroneLights.fini();
 
     std::cout << "\n";
     return DroneLightStatus;
@@ -0,0 +1,61 @@
+// Priority arbitration between MAVLink endpoints that can all send LED
+// commands. A source is only overridden while a higher priority source has
+// sent a command within its own staleness timeout, e.g. a companion
+// computer override beats the GCS radio until it goes quiet.
+//
+// Sources are registered once at startup; accept() is lock-free and is called
+// straight from the MAVSDK callbacks.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#define ARBITER_MAX_SOURCES     8
+#define CACHE_LINE_SIZE         64
+
+class Arbiter
+{
+public:
+	Arbiter() : sourceCount(0) {}
+
+	// Setup only, before any callbacks run. Returns the source id, or -1.
+	int addSource(uint8_t priority, int64_t staleNs)
+	{
+		if (sourceCount >= ARBITER_MAX_SOURCES)
+			return -1;
+
+		sources[sourceCount].priority = priority;
+		sources[sourceCount].staleNs = staleNs;
+		sources[sourceCount].lastSeenNs.store(INT64_MIN / 2, std::memory_order_relaxed);
+		return sourceCount++;
+	}
+
+	// Records activity from source and returns whether its command should be
+	// applied. Equal priorities do not override each other; the latest wins.
+	bool accept(unsigned source, int64_t nowNs)
+	{
+		uint8_t priority = sources[source].priority;
+		sources[source].lastSeenNs.store(nowNs, std::memory_order_relaxed);
+
+		for (unsigned i = 0; i < sourceCount; i++) {
+			if (sources[i].priority <= priority)
+				continue;
+			if (nowNs - sources[i].lastSeenNs.load(std::memory_order_relaxed) < sources[i].staleNs)
+				return false;
+		}
+		return true;
+	}
+
+	unsigned count(void) const { return sourceCount; }
+
+private:
+	// Padded so sources on different MAVSDK threads don't share a line.
+	struct alignas(CACHE_LINE_SIZE) Source {
+		uint8_t priority;
+		int64_t staleNs;
+		std::atomic<int64_t> lastSeenNs;
+	};
+
+	Source sources[ARBITER_MAX_SOURCES];
+	unsigned sourceCount;
+};
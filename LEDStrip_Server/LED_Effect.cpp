@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "LED_Effect.h"
+
+static const char *const InputNames[] =
+{
+	"i", "arm", "len", "arms", "t", "battery", "altitude", "climb", "mode_r", "mode_g", "mode_b",
+};
+static const char *const OutputNames[] = { "r", "g", "b" };
+
+// floor() without a libm call, so lane loops stay vectorisable. Inputs are
+// clamped to where an int32_t can hold them.
+static inline float floorLane(float x)
+{
+	x = std::min(1e9f, std::max(-1e9f, x));
+	float t = (float)(int32_t)x;
+	return t - (float)(t > x);
+}
+
+// Parabola and one correction term over a whole turn; error about 0.001.
+static inline float sinLane(float x)
+{
+	float f = x * 0.15915494f;
+	f -= floorLane(f + 0.5f);               // -0.5 .. 0.5 turns
+	float y = 8.0f * f - 16.0f * f * std::abs(f);
+	return 0.225f * (y * std::abs(y) - y) + y;
+}
+
+// One lane of an instruction, for constant folding. run() has the same
+// operations as loops.
+float Effect::scalar(Op op, float a, float b)
+{
+	switch (op)
+	{
+	case Add:       return a + b;
+	case Sub:       return a - b;
+	case Mul:       return a * b;
+	case Div:       return a / b;
+	case Min:       return std::min(a, b);
+	case Max:       return std::max(a, b);
+	case Less:      return (float)(a < b);
+	case LessEqual: return (float)(a <= b);
+	case Sin:       return sinLane(a);
+	case Cos:       return sinLane(a + 1.5707963f);
+	case Abs:       return std::abs(a);
+	case Floor:     return floorLane(a);
+	case Frac:      return a - floorLane(a);
+	case Sqrt:      return std::sqrt(std::max(a, 0.0f));
+	}
+	return 0;
+}
+
+// 0..1 to 0..255; NaN (0/0 and friends) comes out black.
+static inline uint32_t channelByte(float x)
+{
+	x = x > 0.0f ? x : 0.0f;
+	x = x < 1.0f ? x : 1.0f;
+	return (uint32_t)(x * 255.0f + 0.5f);
+}
+
+// A compile-time constant, or a register. Temporaries hold a reference on
+// their register that is dropped once an instruction has consumed them.
+struct Effect::Value
+{
+	bool constant;
+	float number;
+	uint8_t reg;
+	bool temp;
+
+	static Value of(float number) { return { true, number, 0, false }; }
+	static Value in(uint8_t reg, bool temp) { return { false, 0, reg, temp }; }
+};
+
+class Effect::Compiler
+{
+public:
+	explicit Compiler(Effect &effect) : effect(effect), depth(0)
+	{
+		memset(refs, 0, sizeof(refs));
+		memset(pinned, 0, sizeof(pinned));
+		memset(written, 0, sizeof(written));
+		for (unsigned reg = 0; reg < (unsigned)EffectInput::Count; reg++)
+			pinned[reg] = true;
+	}
+
+	bool statement(const std::string &text)
+	{
+		p = text.c_str();
+		depth = 0;
+		skipSpace();
+		if (!*p || *p == '#')
+			return true;
+
+		std::string name;
+		if (!identifier(name))
+			return fail("expected a variable name");
+		if (inputIndex(name) >= 0)
+			return fail("cannot assign to input '" + name + "'");
+		skipSpace();
+		if (*p != '=')
+			return fail("expected '='");
+		p++;
+
+		Value value;
+		if (!expression(value))
+			return false;
+		skipSpace();
+		if (*p && *p != '#')
+			return fail("unexpected '" + std::string(1, *p) + "'");
+
+		bind(name, value);
+		return true;
+	}
+
+	bool finish(void)
+	{
+		for (unsigned i = 0; i < 3; i++) {
+			auto found = variables.find(OutputNames[i]);
+			Value value = found != variables.end() ? found->second : Value::of(0);
+			if (!materialise(value))
+				return false;
+			effect.outputs[i] = value.reg;
+		}
+		eliminateDeadCode();
+		return true;
+	}
+
+	std::string message;
+
+private:
+	bool fail(const std::string &what)
+	{
+		message = what;
+		return false;
+	}
+
+	// Parentheses, calls and unary minus recurse; bounding them makes a
+	// deeply nested effect a compile error instead of a stack overflow.
+	bool enter(void)
+	{
+		return ++depth <= EFFECT_MAX_NESTING || fail("nested too deeply");
+	}
+
+	void skipSpace(void)
+	{
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+	}
+
+	bool identifier(std::string &name)
+	{
+		if (!isalpha((unsigned char)*p) && *p != '_')
+			return false;
+		const char *start = p;
+		while (isalnum((unsigned char)*p) || *p == '_')
+			p++;
+		name.assign(start, p - start);
+		return true;
+	}
+
+	static int inputIndex(const std::string &name)
+	{
+		for (unsigned i = 0; i < (unsigned)EffectInput::Count; i++)
+			if (name == InputNames[i])
+				return i;
+		return -1;
+	}
+
+	// Registers
+
+	int allocate(void)
+	{
+		for (unsigned reg = 0; reg < EFFECT_MAX_REGISTERS; reg++) {
+			if (pinned[reg] || refs[reg])
+				continue;
+			refs[reg] = 1;
+			written[reg] = true;
+			return reg;
+		}
+		return -1;
+	}
+
+	// Constants are broadcast once at load, so they take registers from the
+	// top that no instruction ever writes.
+	int allocateConstant(void)
+	{
+		for (unsigned reg = EFFECT_MAX_REGISTERS; reg-- > 0; ) {
+			if (pinned[reg] || refs[reg] || written[reg])
+				continue;
+			pinned[reg] = true;
+			return reg;
+		}
+		return -1;
+	}
+
+	void release(const Value &value)
+	{
+		if (value.temp && !pinned[value.reg])
+			refs[value.reg]--;
+	}
+
+	// A second reference to value, released separately.
+	Value share(const Value &value)
+	{
+		if (value.temp)
+			refs[value.reg]++;
+		return value;
+	}
+
+	bool materialise(Value &value)
+	{
+		if (!value.constant)
+			return true;
+
+		for (auto &constant : effect.constants) {
+			if (constant.second == value.number) {
+				value = Value::in(constant.first, false);
+				return true;
+			}
+		}
+		int reg = allocateConstant();
+		if (reg < 0)
+			return fail("effect needs too many registers");
+		effect.constants.emplace_back(reg, value.number);
+		value = Value::in(reg, false);
+		return true;
+	}
+
+	void bind(const std::string &name, Value value)
+	{
+		auto found = variables.find(name);
+		if (found != variables.end())
+			release(found->second);
+
+		// The variable keeps the reference a temporary held, or takes its own.
+		if (!value.constant && !value.temp && !pinned[value.reg])
+			refs[value.reg]++;
+		if (!value.constant && !pinned[value.reg])
+			value.temp = true;
+		variables[name] = value;
+	}
+
+	bool emit(Op op, Value a, Value b, Value &out)
+	{
+		bool unary = op >= Sin;
+		if (a.constant && (unary || b.constant)) {
+			out = Value::of(scalar(op, a.number, b.number));
+			return true;
+		}
+		if (!materialise(a))
+			return false;
+		// Unary instructions read b as well; point it at a.
+		if (unary)
+			b = Value::in(a.reg, false);
+		else if (!materialise(b))
+			return false;
+
+		// Allocated before the operands are released, so the destination
+		// never aliases an operand.
+		int dst = allocate();
+		if (dst < 0)
+			return fail("effect needs too many registers");
+		effect.code.push_back({ op, (uint8_t)dst, a.reg, b.reg });
+		release(a);
+		release(b);
+		out = Value::in(dst, true);
+		return true;
+	}
+
+	// Grammar
+
+	bool expression(Value &out)
+	{
+		if (!enter())
+			return false;
+		bool ok = comparison(out);
+		depth--;
+		return ok;
+	}
+
+	bool comparison(Value &out)
+	{
+		if (!sum(out))
+			return false;
+		while (true) {
+			skipSpace();
+			bool less = *p == '<', greater = *p == '>';
+			if (!less && !greater)
+				return true;
+			p++;
+			bool equal = *p == '=';
+			if (equal)
+				p++;
+
+			Value right;
+			if (!sum(right))
+				return false;
+			// a > b is b < a
+			Op op = equal ? LessEqual : Less;
+			if (!(less ? emit(op, out, right, out) : emit(op, right, out, out)))
+				return false;
+		}
+	}
+
+	bool sum(Value &out)
+	{
+		if (!product(out))
+			return false;
+		while (true) {
+			skipSpace();
+			if (*p != '+' && *p != '-')
+				return true;
+			Op op = *p++ == '+' ? Add : Sub;
+			Value right;
+			if (!product(right) || !emit(op, out, right, out))
+				return false;
+		}
+	}
+
+	bool product(Value &out)
+	{
+		if (!unary(out))
+			return false;
+		while (true) {
+			skipSpace();
+			if (*p != '*' && *p != '/')
+				return true;
+			Op op = *p++ == '*' ? Mul : Div;
+			Value right;
+			if (!unary(right) || !emit(op, out, right, out))
+				return false;
+		}
+	}
+
+	bool unary(Value &out)
+	{
+		skipSpace();
+		if (*p != '-')
+			return primary(out);
+		p++;
+		if (!enter())
+			return false;
+		Value operand;
+		bool ok = unary(operand) && emit(Sub, Value::of(0), operand, out);
+		depth--;
+		return ok;
+	}
+
+	bool primary(Value &out)
+	{
+		skipSpace();
+		if (isdigit((unsigned char)*p) || *p == '.') {
+			char *end;
+			float number = strtof(p, &end);
+			if (end == p)
+				return fail("bad number");
+			p = end;
+			out = Value::of(number);
+			return true;
+		}
+
+		if (*p == '(') {
+			p++;
+			if (!expression(out))
+				return false;
+			skipSpace();
+			if (*p != ')')
+				return fail("expected ')'");
+			p++;
+			return true;
+		}
+
+		std::string name;
+		if (!identifier(name))
+			return fail(*p ? "unexpected '" + std::string(1, *p) + "'" : "expression ends too soon");
+		skipSpace();
+		if (*p == '(')
+			return call(name, out);
+
+		int input = inputIndex(name);
+		if (input >= 0) {
+			out = Value::in(input, false);
+			return true;
+		}
+		auto found = variables.find(name);
+		if (found == variables.end())
+			return fail("unknown name '" + name + "'");
+		out = found->second;
+		out.temp = false;       // Still owned by the variable
+		return true;
+	}
+
+	bool call(const std::string &name, Value &out)
+	{
+		static const struct {
+			const char *name;
+			unsigned arity;
+		} functions[] = {
+			{ "sin", 1 }, { "cos", 1 }, { "abs", 1 }, { "floor", 1 }, { "frac", 1 }, { "sqrt", 1 },
+			{ "min", 2 }, { "max", 2 }, { "step", 2 }, { "clamp", 3 }, { "mix", 3 },
+		};
+
+		unsigned arity = 0;
+		for (auto &function : functions)
+			if (name == function.name)
+				arity = function.arity;
+		if (!arity)
+			return fail("unknown function '" + name + "'");
+
+		Value args[3];
+		p++;
+		for (unsigned i = 0; i < arity; i++) {
+			if (i) {
+				skipSpace();
+				if (*p != ',')
+					return fail(name + " takes " + std::to_string(arity) + " arguments");
+				p++;
+			}
+			if (!expression(args[i]))
+				return false;
+		}
+		skipSpace();
+		if (*p != ')')
+			return fail(name + " takes " + std::to_string(arity) + " arguments");
+		p++;
+
+		Value unused = Value::in(0, false);
+		if (name == "sin")   return emit(Sin, args[0], unused, out);
+		if (name == "cos")   return emit(Cos, args[0], unused, out);
+		if (name == "abs")   return emit(Abs, args[0], unused, out);
+		if (name == "floor") return emit(Floor, args[0], unused, out);
+		if (name == "frac")  return emit(Frac, args[0], unused, out);
+		if (name == "sqrt")  return emit(Sqrt, args[0], unused, out);
+		if (name == "min")   return emit(Min, args[0], args[1], out);
+		if (name == "max")   return emit(Max, args[0], args[1], out);
+		// step(edge, x) is 1 from edge on
+		if (name == "step")  return emit(LessEqual, args[0], args[1], out);
+		if (name == "clamp") {
+			Value low;
+			return emit(Max, args[0], args[1], low) && emit(Min, low, args[2], out);
+		}
+		// mix(a, b, t) = a + (b - a) * t
+		Value a = share(args[0]), span, scaled;
+		return emit(Sub, args[1], args[0], span) && emit(Mul, span, args[2], scaled)
+				&& emit(Add, a, scaled, out);
+	}
+
+	// Variables that never reach r, g or b cost nothing at run time.
+	void eliminateDeadCode(void)
+	{
+		bool live[EFFECT_MAX_REGISTERS] = {};
+		for (uint8_t reg : effect.outputs)
+			live[reg] = true;
+
+		std::vector<Instruction> kept;
+		for (auto it = effect.code.rbegin(); it != effect.code.rend(); ++it) {
+			if (!live[it->dst])
+				continue;
+			live[it->dst] = false;
+			live[it->a] = live[it->b] = true;
+			kept.push_back(*it);
+		}
+		effect.code.assign(kept.rbegin(), kept.rend());
+
+		effect.used = 0;
+		for (unsigned reg = 0; reg < (unsigned)EffectInput::Count; reg++)
+			if (live[reg])
+				effect.used |= 1u << reg;
+
+		bool touched[EFFECT_MAX_REGISTERS] = {};
+		for (auto &in : effect.code)
+			touched[in.dst] = touched[in.a] = touched[in.b] = true;
+		for (uint8_t reg : effect.outputs)
+			touched[reg] = true;
+		effect.registerCount = std::count(touched, touched + EFFECT_MAX_REGISTERS, true);
+	}
+
+	Effect &effect;
+	const char *p;
+	unsigned depth;
+	std::map<std::string, Value> variables;
+	uint8_t refs[EFFECT_MAX_REGISTERS];
+	bool pinned[EFFECT_MAX_REGISTERS];
+	bool written[EFFECT_MAX_REGISTERS];
+};
+
+Effect::Effect() :
+	outputs{},
+	used(0),
+	registerCount(0),
+	active(EFFECT_LANES),
+	inputs{},
+	file{}
+{
+}
+
+bool Effect::compile(const std::string &source)
+{
+	code.clear();
+	constants.clear();
+	message.clear();
+
+	Compiler compiler(*this);
+	std::istringstream lines(source);
+	std::string line;
+	for (unsigned number = 1; std::getline(lines, line); number++) {
+		if (!compiler.statement(line)) {
+			message = "line " + std::to_string(number) + ": " + compiler.message;
+			return false;
+		}
+	}
+	if (!compiler.finish()) {
+		message = compiler.message;
+		return false;
+	}
+
+	// Every lane, whatever layout render() is given later
+	active = EFFECT_LANES;
+	for (auto &constant : constants)
+		broadcast(constant.first, constant.second);
+	return true;
+}
+
+bool Effect::load(const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in) {
+		message = "cannot read " + path;
+		return false;
+	}
+	std::stringstream source;
+	source << in.rdbuf();
+	if (compile(source.str()))
+		return true;
+	message = path + ": " + message;
+	return false;
+}
+
+void Effect::broadcast(unsigned reg, float value)
+{
+	std::fill_n(lanes(reg), active, value);
+}
+
+template <unsigned Lanes, typename F>
+static inline void lanewise(float *__restrict d, const float *a, const float *b, F f)
+{
+	for (unsigned k = 0; k < Lanes; k++)
+		d[k] = f(a[k], b[k]);
+}
+
+// Lanes is a compile-time count so every loop has a fixed trip count, which
+// the compiler vectorises and unrolls better than a variable one.
+template <unsigned Lanes>
+void Effect::runLanes(void)
+{
+	for (const Instruction &in : code) {
+		float *d = lanes(in.dst);
+		const float *a = lanes(in.a), *b = lanes(in.b);
+
+		switch (in.op)
+		{
+		case Add:       lanewise<Lanes>(d, a, b, [](float x, float y) { return x + y; }); break;
+		case Sub:       lanewise<Lanes>(d, a, b, [](float x, float y) { return x - y; }); break;
+		case Mul:       lanewise<Lanes>(d, a, b, [](float x, float y) { return x * y; }); break;
+		case Div:       lanewise<Lanes>(d, a, b, [](float x, float y) { return x / y; }); break;
+		case Min:       lanewise<Lanes>(d, a, b, [](float x, float y) { return std::min(x, y); }); break;
+		case Max:       lanewise<Lanes>(d, a, b, [](float x, float y) { return std::max(x, y); }); break;
+		case Less:      lanewise<Lanes>(d, a, b, [](float x, float y) { return (float)(x < y); }); break;
+		case LessEqual: lanewise<Lanes>(d, a, b, [](float x, float y) { return (float)(x <= y); }); break;
+		case Sin:       lanewise<Lanes>(d, a, b, [](float x, float) { return sinLane(x); }); break;
+		case Cos:       lanewise<Lanes>(d, a, b, [](float x, float) { return sinLane(x + 1.5707963f); }); break;
+		case Abs:       lanewise<Lanes>(d, a, b, [](float x, float) { return std::abs(x); }); break;
+		case Floor:     lanewise<Lanes>(d, a, b, [](float x, float) { return floorLane(x); }); break;
+		case Frac:      lanewise<Lanes>(d, a, b, [](float x, float) { return x - floorLane(x); }); break;
+		case Sqrt:      lanewise<Lanes>(d, a, b, [](float x, float) { return std::sqrt(std::max(x, 0.0f)); }); break;
+		}
+	}
+}
+
+void Effect::run(void)
+{
+	switch (active)
+	{
+	case 8:         runLanes<8>(); break;
+	case 16:        runLanes<16>(); break;
+	case 32:        runLanes<32>(); break;
+	default:        runLanes<EFFECT_LANES>(); break;
+	}
+}
+
+void Effect::render(ws2811_led_t *const strips[], const LayoutSize &size, int64_t channelSums[])
+{
+	// Only as many lanes as an arm has LEDs, rounded up to one of the lane
+	// counts run() is built for
+	active = EFFECT_VECTOR_LANES;
+	while (active < size.length && active < EFFECT_LANES)
+		active *= 2;
+
+	inputs[(unsigned)EffectInput::Length] = size.length;
+	inputs[(unsigned)EffectInput::Arms] = size.arms;
+	for (unsigned input = (unsigned)EffectInput::Length; input < (unsigned)EffectInput::Count; input++)
+		if (used & (1u << input))
+			broadcast(input, inputs[input]);
+
+	const float *r = lanes(outputs[0]), *g = lanes(outputs[1]), *b = lanes(outputs[2]);
+	float *index = lanes((unsigned)EffectInput::Index);
+
+	for (unsigned arm = 0; arm < size.arms; arm++) {
+		if (uses(EffectInput::Arm))
+			broadcast((unsigned)EffectInput::Arm, arm);
+
+		int64_t sum = 0;
+		for (unsigned first = 0; first < size.length; first += EFFECT_LANES) {
+			for (unsigned k = 0; k < active; k++)
+				index[k] = first + k;
+			run();
+
+			unsigned count = std::min<unsigned>(EFFECT_LANES, size.length - first);
+			ws2811_led_t *leds = strips[arm] + first;
+			for (unsigned k = 0; k < count; k++) {
+				uint32_t red = channelByte(r[k]), green = channelByte(g[k]), blue = channelByte(b[k]);
+				leds[k] = red << 16 | green << 8 | blue;
+				sum += red + green + blue;
+			}
+		}
+		channelSums[arm] = sum;
+	}
+}
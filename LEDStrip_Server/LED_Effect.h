@@ -0,0 +1,96 @@
+// User-defined effects: per-LED colour as a function of the LED's position,
+// time and telemetry, loaded from a file at startup instead of compiled in.
+//
+// An effect is a list of assignments, one per line, with '#' comments:
+//
+//     x = frac(i / len - t * 0.5 + arm / arms)
+//     r = step(0.8, x)
+//     g = r * 0.3
+//
+// r, g and b (0 to 1, clamped) are the LED's colour; anything else is a
+// variable. Inputs: i (LED along the arm), arm, len, arms, t (seconds,
+// back to 0 every EFFECT_TIME_WRAP_S so a float keeps sub-millisecond
+// resolution), battery (0 to 1), altitude (m), climb (m/s), and
+// mode_r/mode_g/mode_b (the flight mode colour, 0 to 1). Operators: + - * /
+// and < <= > >= (1 or 0). Expressions nest at most EFFECT_MAX_NESTING deep.
+// Functions: sin cos abs floor frac sqrt min max step clamp mix.
+//
+// compile() folds constants and emits a register bytecode. render() runs it
+// over up to EFFECT_LANES LEDs of an arm at a time: each instruction is one
+// branch-free loop over the lanes, so dispatch is paid once per instruction
+// per block rather than per LED, and the loops vectorise. sin and cos use a
+// polynomial good to about 0.001, well under one 8-bit colour step.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ws2811.h>
+
+#include "LED_Kernels.h"
+
+#define EFFECT_LANES            64
+#define EFFECT_VECTOR_LANES     8           // Fewest lanes run: 8, 16, 32 or 64
+#define EFFECT_MAX_NESTING      64
+#define EFFECT_TIME_WRAP_S      3600        // Periods that divide this loop seamlessly
+#define EFFECT_MAX_REGISTERS    64
+#define EFFECT_DEFAULT_RATE_HZ  100.0
+#define EFFECT_TELEMETRY_RATE_HZ 10.0
+
+enum class EffectInput : uint8_t
+{
+	Index, Arm, Length, Arms, Time, Battery, Altitude, Climb, ModeRed, ModeGreen, ModeBlue,
+	Count
+};
+
+class Effect
+{
+public:
+	Effect();
+
+	// False on a syntax error; error() then says where.
+	bool compile(const std::string &source);
+	bool load(const std::string &path);
+	const std::string &error(void) const { return message; }
+
+	bool uses(EffectInput input) const { return used & (1u << (unsigned)input); }
+	size_t instructions(void) const { return code.size(); }
+	unsigned registers(void) const { return registerCount; }
+
+	// Time, telemetry and mode colour; the layout inputs come from render().
+	void setInput(EffectInput input, float value) { inputs[(unsigned)input] = value; }
+
+	// Writes every LED, and each arm's sum of channel values for the power
+	// limiter into channelSums.
+	void render(ws2811_led_t *const strips[], const LayoutSize &size, int64_t channelSums[]);
+
+private:
+	enum Op : uint8_t { Add, Sub, Mul, Div, Min, Max, Less, LessEqual, Sin, Cos, Abs, Floor, Frac, Sqrt };
+
+	struct Instruction
+	{
+		Op op;
+		uint8_t dst, a, b;
+	};
+
+	struct Value;
+	class Compiler;
+
+	static float scalar(Op op, float a, float b);
+
+	float *lanes(unsigned reg) { return file + reg * EFFECT_LANES; }
+	void broadcast(unsigned reg, float value);
+	void run(void);
+	template <unsigned Lanes> void runLanes(void);
+
+	std::vector<Instruction> code;
+	std::vector<std::pair<uint8_t, float>> constants;
+	uint8_t outputs[3];
+	uint32_t used;
+	unsigned registerCount;
+	unsigned active;            // Lanes run: the arm length, rounded up
+	float inputs[(unsigned)EffectInput::Count];
+	std::string message;
+
+	alignas(64) float file[EFFECT_MAX_REGISTERS * EFFECT_LANES];
+};
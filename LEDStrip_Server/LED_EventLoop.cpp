@@ -0,0 +1,67 @@
+#include <cerrno>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "LED_EventLoop.h"
+
+// Upper bound on how long a signal can go unnoticed.
+#define EVENT_LOOP_TIMEOUT_MS   100
+#define EVENT_LOOP_MAX_EVENTS   16
+
+EventLoop::EventLoop()
+{
+	if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		std::cerr << "epoll_create1 failed: " << strerror(errno) << '\n';
+}
+
+EventLoop::~EventLoop()
+{
+	if (epollFd >= 0)
+		close(epollFd);
+}
+
+bool EventLoop::add(int fd, std::function<void()> handler)
+{
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		std::cerr << "epoll_ctl(ADD) failed: " << strerror(errno) << '\n';
+		return false;
+	}
+
+	handlers.emplace_back(fd, std::move(handler));
+	return true;
+}
+
+bool EventLoop::poll(int timeoutMs)
+{
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+	int ready = epoll_wait(epollFd, events, EVENT_LOOP_MAX_EVENTS, timeoutMs);
+	if (ready < 0) {
+		if (errno == EINTR)
+			return true;
+		std::cerr << "epoll_wait failed: " << strerror(errno) << '\n';
+		return false;
+	}
+
+	for (int i = 0; i < ready; i++) {
+		// Handlers are few; a linear scan beats a map here.
+		for (auto &handler : handlers) {
+			if (handler.first == events[i].data.fd) {
+				handler.second();
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+void EventLoop::run(const volatile sig_atomic_t &running)
+{
+	while (running && poll(EVENT_LOOP_TIMEOUT_MS)) { }
+}
@@ -0,0 +1,37 @@
+// Single-threaded epoll loop. Everything that touches the LEDs runs here;
+// MAVSDK callbacks only hand work over through file descriptors.
+#pragma once
+
+#include <cstdint>
+#include <csignal>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+// CLOCK_MONOTONIC in nanoseconds. All deadlines inside the server use this.
+inline int64_t monotonicNowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+class EventLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+
+	// Call handler (on the loop thread) whenever fd becomes readable.
+	bool add(int fd, std::function<void()> handler);
+
+	// Dispatch whatever becomes ready within timeoutMs. False on error.
+	bool poll(int timeoutMs);
+
+	// Dispatch until running is cleared (e.g. from a signal handler).
+	void run(const volatile sig_atomic_t &running);
+
+private:
+	int epollFd;
+	std::vector<std::pair<int, std::function<void()>>> handlers;
+};
@@ -0,0 +1,135 @@
+#include <cerrno>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "LED_FastPath.h"
+
+// Datagrams handled per wakeup, so one busy peer can't starve the loop.
+#define FASTPATH_BATCH          64
+
+bool MavlinkLedParser::decodeLed(mavlink_led_strip_config_t &config)
+{
+	uint8_t payloadLen = frame[1];
+	size_t headerLen = MAVLINK_CORE_HEADER_LEN + 1;
+
+	uint16_t crc;
+	crc_init(&crc);
+	for (size_t i = 1; i < headerLen + payloadLen; i++)
+		crc_accumulate(frame[i], &crc);
+	crc_accumulate(MAVLINK_MSG_ID_LED_STRIP_CONFIG_CRC, &crc);
+
+	if ((crc & 0xFF) != frame[headerLen + payloadLen]
+			|| (crc >> 8) != frame[headerLen + payloadLen + 1]) {
+		crcErrors++;
+		return false;
+	}
+
+	// MAVLink 2 trims trailing zeros; the generated decoder pads them back.
+	scratch.len = payloadLen;
+	memcpy(scratch.payload64, frame + headerLen, payloadLen);
+	mavlink_msg_led_strip_config_decode(&scratch, &config);
+	return true;
+}
+
+FastPath::FastPath(uint16_t port, uint16_t forwardPort, unsigned source, LedHandler onLed) :
+	publicFd(-1),
+	forwardFd(-1),
+	source(source),
+	onLed(onLed),
+	peerCount(0),
+	leds(0)
+{
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	publicFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (publicFd < 0 || bind(publicFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		std::cerr << "fast path: bind to port " << port << " failed: " << strerror(errno) << '\n';
+		return;
+	}
+
+	// MAVSDK listens on forwardPort and answers whoever sent to it: us.
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(forwardPort);
+
+	forwardFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (forwardFd < 0 || connect(forwardFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		std::cerr << "fast path: connect to port " << forwardPort << " failed: " << strerror(errno) << '\n';
+		return;
+	}
+}
+
+FastPath::~FastPath()
+{
+	if (publicFd >= 0)
+		close(publicFd);
+	if (forwardFd >= 0)
+		close(forwardFd);
+}
+
+size_t FastPath::receive(void)
+{
+	size_t handled = 0;
+
+	for (int i = 0; i < FASTPATH_BATCH; i++) {
+		struct sockaddr_in peer;
+		socklen_t peerLen = sizeof(peer);
+		ssize_t len = recvfrom(publicFd, datagram, sizeof(datagram), 0, (struct sockaddr *)&peer, &peerLen);
+		if (len <= 0)
+			break;
+
+		rememberPeer(peer);
+
+		// Frames never span datagrams. Whatever the parser is still holding at
+		// the end (a truncated frame, or a stray start byte in other traffic)
+		// goes to MAVSDK with the rest, so every byte not taken as an LED
+		// command is relayed.
+		size_t relayLen = 0;
+		auto toRelay = [this, &relayLen](const uint8_t *bytes, size_t count) {
+			memcpy(relay + relayLen, bytes, count);
+			relayLen += count;
+		};
+		parser.feed(datagram, len,
+			[this, &handled](const mavlink_led_strip_config_t &config, const LedSender &sender) {
+				onLed(config, sender, source);
+				handled++;
+			},
+			toRelay);
+		parser.flush(toRelay);
+
+		if (relayLen > 0)
+			send(forwardFd, relay, relayLen, 0);
+	}
+
+	leds += handled;
+	return handled;
+}
+
+void FastPath::relayReplies(void)
+{
+	for (int i = 0; i < FASTPATH_BATCH; i++) {
+		ssize_t len = recv(forwardFd, relay, sizeof(relay), 0);
+		if (len <= 0)
+			break;
+
+		for (unsigned p = 0; p < peerCount; p++)
+			sendto(publicFd, relay, len, 0, (struct sockaddr *)&peers[p], sizeof(peers[p]));
+	}
+}
+
+void FastPath::rememberPeer(const struct sockaddr_in &peer)
+{
+	for (unsigned p = 0; p < peerCount; p++)
+		if (peers[p].sin_addr.s_addr == peer.sin_addr.s_addr && peers[p].sin_port == peer.sin_port)
+			return;
+
+	if (peerCount < FASTPATH_MAX_PEERS)
+		peers[peerCount++] = peer;
+	else
+		peers[FASTPATH_MAX_PEERS - 1] = peer;
+}
@@ -0,0 +1,142 @@
+// Optional fast path for LED commands arriving over UDP.
+//
+// The fast path owns the public UDP port. Each datagram is run through an
+// incremental MAVLink v2 frame parser. Unsigned LED_STRIP_CONFIG frames with
+// a good CRC are decoded in place and handed straight to the framebuffer
+// writer. Every other byte, including signed LED frames (whose signature only
+// MAVSDK can check) and LED frames failing CRC, is relayed to a MAVSDK endpoint on a loopback port, and MAVSDK's replies
+// are relayed back to the peers we have heard from. Nothing allocates after
+// construction.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include "LED_Scheduler.h"
+
+#define FASTPATH_MAX_PEERS      4
+#define FASTPATH_DATAGRAM_SIZE  2048
+
+// Splits a byte stream into MAVLink frames. Feed it any chunking of the stream;
+// onLed(config, sender) gets each unsigned LED_STRIP_CONFIG with a good CRC,
+// onOther(bytes, len) gets every other frame (and any garbage between frames)
+// verbatim.
+class MavlinkLedParser
+{
+public:
+	MavlinkLedParser() : have(0), need(0), headerDone(false), crcErrors(0) {}
+
+	void reset(void) { have = 0; need = 0; headerDone = false; }
+	uint64_t badCrcCount(void) const { return crcErrors; }
+
+	template <typename OnLed, typename OnOther>
+	void feed(const uint8_t *data, size_t len, OnLed &&onLed, OnOther &&onOther);
+
+	// Ends the stream: bytes of a frame still incomplete go to onOther as they
+	// came, so nothing fed is lost, and the parser starts afresh.
+	template <typename OnOther>
+	void flush(OnOther &&onOther)
+	{
+		if (have > 0)
+			onOther(frame, have);
+		reset();
+	}
+
+private:
+	bool decodeLed(mavlink_led_strip_config_t &config);
+
+	uint8_t frame[MAVLINK_MAX_PACKET_LEN];
+	size_t have;
+	size_t need;
+	bool headerDone;
+	uint64_t crcErrors;
+	mavlink_message_t scratch;  // Lets the generated decoder handle truncation
+};
+
+template <typename OnLed, typename OnOther>
+void MavlinkLedParser::feed(const uint8_t *data, size_t len, OnLed &&onLed, OnOther &&onOther)
+{
+	while (len > 0) {
+		if (have == 0) {
+			// Hunt for a start byte; pass anything before it through.
+			size_t skip = 0;
+			while (skip < len && data[skip] != MAVLINK_STX && data[skip] != MAVLINK_STX_MAVLINK1)
+				skip++;
+			if (skip > 0) {
+				onOther(data, skip);
+				data += skip;
+				len -= skip;
+				continue;
+			}
+			need = (data[0] == MAVLINK_STX) ? MAVLINK_CORE_HEADER_LEN + 1 : 6;
+			headerDone = false;
+		}
+
+		size_t chunk = need - have;
+		if (chunk > len)
+			chunk = len;
+		memcpy(frame + have, data, chunk);
+		have += chunk;
+		data += chunk;
+		len -= chunk;
+		if (have < need)
+			return;
+
+		if (!headerDone) {
+			headerDone = true;
+			need += frame[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+			if (frame[0] == MAVLINK_STX && (frame[2] & MAVLINK_IFLAG_SIGNED))
+				need += MAVLINK_SIGNATURE_BLOCK_LEN;
+			continue;
+		}
+
+		bool isLed = frame[0] == MAVLINK_STX && !(frame[2] & MAVLINK_IFLAG_SIGNED)
+			&& (frame[7] | (frame[8] << 8) | ((uint32_t)frame[9] << 16)) == MAVLINK_MSG_ID_LED_STRIP_CONFIG;
+		mavlink_led_strip_config_t config;
+		if (isLed && decodeLed(config))
+			onLed(config, LedSender{ frame[5], frame[6], frame[4] });
+		else
+			onOther(frame, have);
+		have = 0;
+	}
+}
+
+class FastPath
+{
+public:
+	// Called on the event loop for every valid LED command, before any render.
+	typedef void (*LedHandler)(const mavlink_led_strip_config_t &config, const LedSender &sender, unsigned source);
+
+	FastPath(uint16_t port, uint16_t forwardPort, unsigned source, LedHandler onLed);
+	~FastPath();
+
+	bool ok(void) const { return publicFd >= 0 && forwardFd >= 0; }
+	int fd(void) const { return publicFd; }
+	int forwardingFd(void) const { return forwardFd; }
+
+	// Event loop handlers. receive() returns the number of LED commands handled.
+	size_t receive(void);
+	void relayReplies(void);
+
+	uint64_t ledCount(void) const { return leds; }
+	uint64_t badCrcCount(void) const { return parser.badCrcCount(); }
+
+private:
+	void rememberPeer(const struct sockaddr_in &peer);
+
+	int publicFd;
+	int forwardFd;
+	unsigned source;
+	LedHandler onLed;
+	MavlinkLedParser parser;
+
+	struct sockaddr_in peers[FASTPATH_MAX_PEERS];
+	unsigned peerCount;
+	uint64_t leds;
+
+	uint8_t datagram[FASTPATH_DATAGRAM_SIZE];
+	uint8_t relay[FASTPATH_DATAGRAM_SIZE];
+};
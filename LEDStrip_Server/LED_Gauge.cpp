@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string.h>
+
+#include "LED_Gauge.h"
+
+#define GAUGE_RED               0x00FF0000
+#define GAUGE_GREEN             0x0000FF00
+
+Gauge::Gauge(Source source, float min, float max, unsigned levels) :
+	gaugeSource(source),
+	min(min),
+	max(max),
+	levelCount(levels),
+	primed(false),
+	lastNs(0),
+	filtered(0.0f),
+	slope(0.0f),
+	current(0)
+{
+	// A full battery is good news; high, fast or far away is not.
+	if (source == Source::Battery) {
+		lowColour = GAUGE_RED;
+		highColour = GAUGE_GREEN;
+	} else {
+		lowColour = GAUGE_GREEN;
+		highColour = GAUGE_RED;
+	}
+}
+
+bool Gauge::parse(const char *arg, Gauge &gauge, unsigned levels)
+{
+	static const struct {
+		const char *name;
+		Source source;
+		float min, max;
+	} defaults[] = {
+		{ "battery",  Source::Battery,      0.0f,   1.0f },   // remaining fraction
+		{ "altitude", Source::Altitude,     0.0f, 120.0f },   // m above home
+		{ "climb",    Source::ClimbRate,   -5.0f,   5.0f },   // m/s, up is positive
+		{ "home",     Source::HomeDistance, 0.0f, 500.0f },   // m
+	};
+
+	const char *comma = strchr(arg, ',');
+	size_t nameLen = comma ? (size_t)(comma - arg) : strlen(arg);
+
+	for (auto &entry : defaults) {
+		if (strlen(entry.name) != nameLen || strncasecmp(entry.name, arg, nameLen))
+			continue;
+
+		float min = entry.min, max = entry.max;
+		if (comma) {
+			char *end;
+			min = strtof(comma + 1, &end);
+			if (*end != ',')
+				return false;
+			max = strtof(end + 1, &end);
+			if (*end != '\0' || !(max > min))
+				return false;
+		}
+
+		gauge = Gauge(entry.source, min, max, levels);
+		return true;
+	}
+	return false;
+}
+
+bool Gauge::sample(float value, int64_t nowNs)
+{
+	if (!std::isfinite(value))
+		return false;
+
+	float scaled = (std::clamp(value, min, max) - min) / (max - min) * levelCount;
+
+	if (!primed) {
+		primed = true;
+		lastNs = nowNs;
+		filtered = scaled;
+		current = (unsigned)std::lround(scaled);
+		return true;
+	}
+
+	float dt = (nowNs - lastNs) / 1e9f;
+	if (dt <= 0.0f)
+		return false;
+	lastNs = nowNs;
+
+	float alpha = 1.0f - std::exp(-dt / GAUGE_TIME_CONSTANT_S);
+	float previous = filtered;
+	filtered += alpha * (scaled - filtered);
+	slope += alpha * ((filtered - previous) / dt - slope);
+
+	// Only move once the filtered value is clearly inside another level.
+	if (std::fabs(filtered - (float)current) < 0.5f + GAUGE_HYSTERESIS)
+		return false;
+
+	unsigned next = (unsigned)std::lround(filtered);
+	if (next == current)
+		return false;
+	current = next;
+	return true;
+}
+
+double Gauge::suggestedRateHz(void) const
+{
+	// Aim for a quarter of a level per sample.
+	return std::clamp(std::fabs(slope) * 4.0, GAUGE_MIN_RATE_HZ, GAUGE_MAX_RATE_HZ);
+}
+
+ws2811_led_t Gauge::colourAt(unsigned pos) const
+{
+	unsigned span = levelCount > 1 ? levelCount - 1 : 1;
+	ws2811_led_t colour = 0;
+
+	for (int shift = 0; shift <= 16; shift += 8) {
+		int low = (lowColour >> shift) & 0xFF;
+		int high = (highColour >> shift) & 0xFF;
+		colour |= (ws2811_led_t)(low + (high - low) * (int)pos / (int)span) << shift;
+	}
+	return colour;
+}
@@ -0,0 +1,57 @@
+// Maps a continuous telemetry value (battery, altitude, climb rate, distance
+// to home) onto a bar of LEDs along each arm.
+//
+// Samples are low-pass filtered and quantized to the number of LEDs per arm
+// with a little hysteresis, and sample() only reports a change when the
+// quantized level moves, so noisy telemetry at full rate costs almost no
+// renders. The filter also tracks how fast the value moves so the telemetry
+// rate can be lowered while it is steady.
+#pragma once
+
+#include <cstdint>
+#include <ws2811.h>
+
+#define GAUGE_TIME_CONSTANT_S   1.0f
+#define GAUGE_HYSTERESIS        0.15f       // In levels, on top of half a level
+#define GAUGE_MIN_RATE_HZ       1.0
+#define GAUGE_MAX_RATE_HZ       10.0
+
+class Gauge
+{
+public:
+	enum class Source { Battery, Altitude, ClimbRate, HomeDistance };
+
+	Gauge() : Gauge(Source::Battery, 0.0f, 1.0f, 1) {}
+	Gauge(Source source, float min, float max, unsigned levels);
+
+	// "battery", "altitude", "climb" or "home", optionally ",min,max".
+	static bool parse(const char *arg, Gauge &gauge, unsigned levels);
+
+	// Feed one sample. Not thread-safe: call from a single telemetry thread.
+	// Returns true when the quantized level changes.
+	bool sample(float value, int64_t nowNs);
+
+	Source source(void) const { return gaugeSource; }
+	unsigned level(void) const { return current; }
+	unsigned levels(void) const { return levelCount; }
+
+	// Telemetry rate that keeps each sample within a fraction of a level.
+	double suggestedRateHz(void) const;
+
+	// Colour of LED pos (of levels()) in the bar, from the low to the high end.
+	ws2811_led_t colourAt(unsigned pos) const;
+
+private:
+	Source gaugeSource;
+	float min;
+	float max;
+	unsigned levelCount;
+	ws2811_led_t lowColour;
+	ws2811_led_t highColour;
+
+	bool primed;
+	int64_t lastNs;
+	float filtered;
+	float slope;                // Filtered rate of change, in levels per second
+	unsigned current;
+};
@@ -0,0 +1,29 @@
+#include "LED_Kernels.h"
+
+// bar() stays generic: its work depends on the level, not just the layout,
+// and fixed bounds only made the larger layouts slower.
+template <unsigned Arms, unsigned Length>
+static constexpr LayoutKernels kernelsOf(const char *name)
+{
+	return { name, LayoutKernel<Arms, Length>::fillArm, LayoutKernel<Arms, Length>::fill, LayoutKernel<0, 0>::bar };
+}
+
+// The layouts we deploy. Add one here to give it its own kernels.
+static constexpr LayoutKernels Specialised[] =
+{
+	kernelsOf<2, 5>("2x5"),
+	kernelsOf<4, 30>("4x30"),
+	kernelsOf<6, 60>("6x60"),
+	kernelsOf<8, 60>("8x60"),
+};
+static constexpr LayoutSize SpecialisedSizes[] = { {2, 5}, {4, 30}, {6, 60}, {8, 60} };
+
+static constexpr LayoutKernels Generic = kernelsOf<0, 0>("generic");
+
+const LayoutKernels &layoutKernels(const LayoutSize &size)
+{
+	for (unsigned i = 0; i < sizeof(Specialised) / sizeof(Specialised[0]); i++)
+		if (SpecialisedSizes[i].arms == size.arms && SpecialisedSizes[i].length == size.length)
+			return Specialised[i];
+	return Generic;
+}
@@ -0,0 +1,67 @@
+// Whole-framebuffer kernels, specialised at compile time for the layouts we
+// fly (arms x LEDs per arm) and picked once at startup.
+//
+// LayoutKernel<Arms, Length> bakes the layout into the loop bounds, so the
+// compiler unrolls the short loops and vectorises the long ones.
+// LayoutKernel<0, 0> takes the layout at run time and covers everything else.
+// Kernels only write the framebuffer; keeping the power estimate current is
+// up to the caller.
+#pragma once
+
+#include <cstdint>
+#include <ws2811.h>
+
+struct LayoutSize
+{
+	unsigned arms;
+	unsigned length;
+};
+
+template <unsigned Arms, unsigned Length>
+struct LayoutKernel
+{
+	static unsigned arms(const LayoutSize &size) { return Arms ? Arms : size.arms; }
+	static unsigned length(const LayoutSize &size) { return Length ? Length : size.length; }
+
+	// Every LED of one arm.
+	static void fillArm(ws2811_led_t *arm, const LayoutSize &size, ws2811_led_t colour)
+	{
+		const unsigned n = length(size);
+		for (unsigned pos = 0; pos < n; pos++)
+			arm[pos] = colour;
+	}
+
+	// Every LED of every arm.
+	static void fill(ws2811_led_t *const strips[], const LayoutSize &size, ws2811_led_t colour)
+	{
+		const unsigned count = arms(size);
+		for (unsigned arm = 0; arm < count; arm++)
+			fillArm(strips[arm], size, colour);
+	}
+
+	// The first level LEDs of every arm from ramp, the rest off.
+	static void bar(ws2811_led_t *const strips[], const LayoutSize &size, const ws2811_led_t *ramp, unsigned level)
+	{
+		const unsigned count = arms(size), n = length(size);
+		if (level > n)
+			level = n;
+		for (unsigned arm = 0; arm < count; arm++) {
+			ws2811_led_t *leds = strips[arm];
+			for (unsigned pos = 0; pos < level; pos++)
+				leds[pos] = ramp[pos];
+			for (unsigned pos = level; pos < n; pos++)
+				leds[pos] = 0;
+		}
+	}
+};
+
+struct LayoutKernels
+{
+	const char *name;
+	void (*fillArm)(ws2811_led_t *arm, const LayoutSize &size, ws2811_led_t colour);
+	void (*fill)(ws2811_led_t *const strips[], const LayoutSize &size, ws2811_led_t colour);
+	void (*bar)(ws2811_led_t *const strips[], const LayoutSize &size, const ws2811_led_t *ramp, unsigned level);
+};
+
+// The specialised kernels for this layout if there are any, else the generic ones.
+const LayoutKernels &layoutKernels(const LayoutSize &size);
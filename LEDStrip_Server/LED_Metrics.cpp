@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "LED_Metrics.h"
+
+Metrics metrics;
+
+MetricsServer::MetricsServer(const std::string &path) :
+	path(path),
+	listenFd(-1)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "metrics: socket path too long: " << path << '\n';
+		return;
+	}
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	// A stale socket from a previous run would make bind fail.
+	unlink(path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		std::cerr << "metrics: cannot listen on " << path << ": " << strerror(errno) << '\n';
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	listenFd = fd;
+}
+
+MetricsServer::~MetricsServer()
+{
+	if (listenFd >= 0) {
+		close(listenFd);
+		unlink(path.c_str());
+	}
+}
+
+void MetricsServer::serve(unsigned sourceCount)
+{
+	int client;
+	while ((client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+		// Whatever the client asked (HTTP GET or nothing at all), it gets the
+		// metrics. Drain what has already arrived so close() doesn't reset.
+		char request[512];
+		recv(client, request, sizeof(request), MSG_DONTWAIT);
+
+		size_t bodyLen = format(sourceCount);
+		char header[128];
+		int headerLen = snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n\r\n", bodyLen);
+
+		send(client, header, headerLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		send(client, response, bodyLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(client);
+	}
+}
+
+static size_t append(char *buffer, size_t used, const char *format, ...)
+{
+	if (used >= METRICS_RESPONSE_SIZE)
+		return used;
+
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(buffer + used, METRICS_RESPONSE_SIZE - used, format, args);
+	va_end(args);
+
+	if (written < 0)
+		return used;
+	return std::min<size_t>(used + written, METRICS_RESPONSE_SIZE - 1);
+}
+
+size_t MetricsServer::format(unsigned sourceCount)
+{
+	size_t n = 0;
+
+	n = append(response, n, "# TYPE ledstrip_messages_received_total counter\n");
+	for (unsigned source = 0; source < sourceCount; source++)
+		n = append(response, n, "ledstrip_messages_received_total{source=\"%u\"} %llu\n",
+			source, (unsigned long long)metrics.messagesReceived[source].get());
+
+	n = append(response, n, "# TYPE ledstrip_messages_overridden_total counter\n");
+	for (unsigned source = 0; source < sourceCount; source++)
+		n = append(response, n, "ledstrip_messages_overridden_total{source=\"%u\"} %llu\n",
+			source, (unsigned long long)metrics.messagesOverridden[source].get());
+
+	n = append(response, n,
+		"# TYPE ledstrip_messages_not_for_us_total counter\n"
+		"ledstrip_messages_not_for_us_total %llu\n"
+		"# TYPE ledstrip_commands_dropped_total counter\n"
+		"ledstrip_commands_dropped_total %llu\n"
+		"# TYPE ledstrip_execute_at_rejected_total counter\n"
+		"ledstrip_execute_at_rejected_total %llu\n"
+		"# TYPE ledstrip_frames_requested_total counter\n"
+		"ledstrip_frames_requested_total %llu\n"
+		"# TYPE ledstrip_frames_rendered_total counter\n"
+		"ledstrip_frames_rendered_total %llu\n"
+		"# TYPE ledstrip_frames_coalesced_total counter\n"
+		"ledstrip_frames_coalesced_total %llu\n"
+		"# TYPE ledstrip_render_failures_total counter\n"
+		"ledstrip_render_failures_total %llu\n"
+		"# TYPE ledstrip_render_seconds_total counter\n"
+		"ledstrip_render_seconds_total %.9f\n"
+		"# TYPE ledstrip_render_last_seconds gauge\n"
+		"ledstrip_render_last_seconds %.9f\n"
+		"# TYPE ledstrip_render_spread_last_seconds gauge\n"
+		"ledstrip_render_spread_last_seconds %.9f\n"
+		"# TYPE ledstrip_power_estimate_milliamps gauge\n"
+		"ledstrip_power_estimate_milliamps %llu\n"
+		"# TYPE ledstrip_power_limited_frames_total counter\n"
+		"ledstrip_power_limited_frames_total %llu\n"
+		"# TYPE ledstrip_queue_depth gauge\n"
+		"ledstrip_queue_depth %llu\n"
+		"# TYPE ledstrip_status_reports_total counter\n"
+		"ledstrip_status_reports_total %llu\n"
+		"# TYPE ledstrip_following_flight_mode gauge\n"
+		"ledstrip_following_flight_mode %llu\n"
+		"# TYPE ledstrip_colour gauge\n"
+		"ledstrip_colour %llu\n",
+		(unsigned long long)metrics.messagesNotForUs.get(),
+		(unsigned long long)metrics.commandsDropped.get(),
+		(unsigned long long)metrics.executeAtRejected.get(),
+		(unsigned long long)metrics.framesRequested.get(),
+		(unsigned long long)metrics.framesRendered.get(),
+		(unsigned long long)metrics.framesCoalesced.get(),
+		(unsigned long long)metrics.renderFailures.get(),
+		metrics.renderNsTotal.get() / 1e9,
+		metrics.renderNsLast.get() / 1e9,
+		metrics.renderSpreadNsLast.get() / 1e9,
+		(unsigned long long)metrics.powerEstimateMa.get(),
+		(unsigned long long)metrics.powerLimitedFrames.get(),
+		(unsigned long long)metrics.queueDepth.get(),
+		(unsigned long long)metrics.statusReports.get(),
+		(unsigned long long)metrics.followingFlightMode.get(),
+		(unsigned long long)metrics.colour.get());
+
+	return n;
+}
@@ -0,0 +1,70 @@
+// Runtime counters, exported in Prometheus text format over a Unix socket.
+//
+// Every counter sits on its own cache line so MAVSDK threads bumping message
+// counts never contend with the event loop bumping frame counts. Updates are
+// relaxed atomic adds; scrapes are served from the event loop and only read.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "LED_Arbiter.h"
+
+#define METRICS_RESPONSE_SIZE   8192
+
+struct alignas(CACHE_LINE_SIZE) MetricCounter
+{
+	std::atomic<uint64_t> value{0};
+
+	void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+	uint64_t get(void) const { return value.load(std::memory_order_relaxed); }
+};
+
+struct Metrics
+{
+	MetricCounter messagesReceived[ARBITER_MAX_SOURCES];
+	MetricCounter messagesOverridden[ARBITER_MAX_SOURCES];
+	MetricCounter messagesNotForUs;    // Addressed to another vehicle or component
+	MetricCounter commandsDropped;
+	MetricCounter executeAtRejected;   // Execute-at time outside the accepted window
+
+	MetricCounter framesRequested;
+	MetricCounter framesRendered;
+	MetricCounter framesCoalesced;
+	MetricCounter renderFailures;
+	MetricCounter renderNsTotal;
+	MetricCounter renderNsLast;
+	MetricCounter renderSpreadNsLast;  // First to last ws2811 instance started
+
+	MetricCounter powerEstimateMa;
+	MetricCounter powerLimitedFrames;
+
+	MetricCounter queueDepth;
+	MetricCounter statusReports;
+	MetricCounter followingFlightMode;
+	MetricCounter colour;
+};
+
+extern Metrics metrics;
+
+class MetricsServer
+{
+public:
+	explicit MetricsServer(const std::string &path);
+	~MetricsServer();
+
+	bool ok(void) const { return listenFd >= 0; }
+	int fd(void) const { return listenFd; }
+
+	// Event loop handler: answer every pending connection with one scrape.
+	void serve(unsigned sourceCount);
+
+private:
+	size_t format(unsigned sourceCount);
+
+	std::string path;
+	int listenFd;
+	char response[METRICS_RESPONSE_SIZE];
+};
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include "LED_EventLoop.h"
+#include "LED_Output.h"
+
+#define OUTPUT_DMA_LIMIT        14          // Channels above are used by the GPU
+
+LedOutput::LedOutput() :
+	type(WS2811_STRIP_GRB),
+	armCount(0),
+	armLength(0),
+	stripCount(0),
+	instanceCount(0),
+	simulated(false),
+	initialised(false),
+	spreadNs(0)
+{
+	memset(lights, 0, sizeof(lights));
+	for (unsigned i = 0; i < OUTPUT_MAX_INSTANCES; i++) {
+		lights[i].freq = WS2811_TARGET_FREQ;
+		for (auto &channel : lights[i].channel)
+			channel.brightness = 255;
+		doneNs[i] = 0;
+		instancePeripheral[i] = Pwm;
+		startOrder[i] = i;
+	}
+	for (unsigned arm = 0; arm < OUTPUT_MAX_ARMS; arm++)
+		armStrip[arm] = armOffset[arm] = 0;
+	for (unsigned strip = 0; strip < OUTPUT_MAX_STRIPS; strip++)
+		stripInstance[strip] = stripChannel[strip] = 0;
+}
+
+bool LedOutput::setLayout(unsigned arms, unsigned length)
+{
+	if (arms == 0 || arms > OUTPUT_MAX_ARMS || length == 0)
+		return false;
+
+	armCount = arms;
+	armLength = length;
+	return true;
+}
+
+void LedOutput::setStripType(int stripType)
+{
+	type = stripType;
+}
+
+bool LedOutput::setGpios(const std::vector<int> &gpios)
+{
+	if (gpios.size() > OUTPUT_MAX_ARMS)
+		return false;
+	gpioList = gpios;
+	return true;
+}
+
+// The pins rpi_ws281x can drive a strip from.
+bool LedOutput::peripheralOf(int gpio, Peripheral &peripheral, unsigned &pwmChannel)
+{
+	switch (gpio) {
+	case 12: case 18: case 40: case 52:
+		peripheral = Pwm;
+		pwmChannel = 0;
+		return true;
+	case 13: case 19: case 41: case 45: case 53:
+		peripheral = Pwm;
+		pwmChannel = 1;
+		return true;
+	case 21: case 31:
+		peripheral = Pcm;
+		return true;
+	case 10: case 38:
+		peripheral = Spi;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Chains the arms onto strips by GPIO, and deals the strips out to
+// instances by peripheral. PCM and SPI only have channel 0, and each PWM
+// channel takes one strip.
+bool LedOutput::assign(void)
+{
+	static const char *const Names[PeripheralCount] = { "PWM", "PCM", "SPI" };
+	int instanceOf[PeripheralCount] = { -1, -1, -1 };
+	int usedBy[PeripheralCount][RPI_PWM_CHANNELS];
+	int stripGpio[OUTPUT_MAX_STRIPS];
+
+	for (auto &row : usedBy)
+		for (auto &gpio : row)
+			gpio = -1;
+	for (unsigned i = 0; i < OUTPUT_MAX_INSTANCES; i++)
+		for (auto &channel : lights[i].channel) {
+			channel.gpionum = 0;
+			channel.count = 0;
+			channel.strip_type = type;
+		}
+
+	if (gpioList.empty()) {
+		std::cerr << "no GPIO for the arms; give at least one with -g\n";
+		return false;
+	}
+
+	instanceCount = stripCount = 0;
+	for (unsigned arm = 0; arm < armCount; arm++) {
+		int gpio = gpioList.size() >= armCount ? gpioList[arm] : gpioList[arm * gpioList.size() / armCount];
+
+		unsigned strip = 0;
+		while (strip < stripCount && stripGpio[strip] != gpio)
+			strip++;
+
+		if (strip == stripCount) {
+			Peripheral peripheral;
+			unsigned pwmChannel = 0;
+			if (!peripheralOf(gpio, peripheral, pwmChannel)) {
+				std::cerr << "GPIO " << gpio << " (arm " << arm << ") can't drive LEDs;"
+						<< " use 12 or 18 and 13 or 19 (PWM), 21 (PCM) or 10 (SPI)\n";
+				return false;
+			}
+			if (usedBy[peripheral][pwmChannel] >= 0) {
+				std::cerr << "GPIO " << usedBy[peripheral][pwmChannel] << " and " << gpio << " both need "
+						<< Names[peripheral] << (peripheral == Pwm ? pwmChannel ? "1" : "0" : "")
+						<< ", which drives one strip; give arms chained on it the same GPIO\n";
+				return false;
+			}
+			usedBy[peripheral][pwmChannel] = gpio;
+
+			if (instanceOf[peripheral] < 0) {
+				instancePeripheral[instanceCount] = peripheral;
+				instanceOf[peripheral] = instanceCount++;
+			}
+			stripGpio[strip] = gpio;
+			stripInstance[strip] = instanceOf[peripheral];
+			stripChannel[strip] = pwmChannel;
+			channel(strip).gpionum = gpio;
+			stripCount++;
+		}
+
+		armStrip[arm] = strip;
+		armOffset[arm] = channel(strip).count;
+		channel(strip).count += armLength;
+	}
+
+	// SPI blocks in start(), so it goes after the DMA instances
+	unsigned started = 0;
+	for (unsigned i = 0; i < instanceCount; i++)
+		if (instancePeripheral[i] != Spi)
+			startOrder[started++] = i;
+	if (instanceOf[Spi] >= 0)
+		startOrder[started++] = instanceOf[Spi];
+	return true;
+}
+
+// Instances past the end of the list take the channels after the last one.
+bool LedOutput::setDmas(const std::vector<int> &dmas)
+{
+	if (dmas.empty() || dmas.size() > OUTPUT_MAX_INSTANCES)
+		return false;
+	for (unsigned i = 0; i < OUTPUT_MAX_INSTANCES; i++)
+		lights[i].dmanum = i < dmas.size() ? dmas[i] : dmas.back() + (int)(i - dmas.size() + 1);
+	return true;
+}
+
+ws2811_return_t LedOutput::init(void)
+{
+	if (!assign())
+		return WS2811_ERROR_GENERIC;
+
+	if (simulated) {
+		for (unsigned strip = 0; strip < stripCount; strip++) {
+			framebuffers[strip].assign(channel(strip).count, 0);
+			channel(strip).leds = framebuffers[strip].data();
+		}
+		initialised = true;
+		return WS2811_SUCCESS;
+	}
+
+	for (unsigned i = 0; i < instanceCount; i++) {
+		if (lights[i].dmanum >= OUTPUT_DMA_LIMIT) {
+			std::cerr << "no DMA channel for instance " << i << "; give one per peripheral with -d\n";
+			fini();
+			return WS2811_ERROR_GENERIC;
+		}
+
+		ws2811_return_t status = ws2811_init(&lights[i]);
+		if (status != WS2811_SUCCESS) {
+			fini();
+			return status;
+		}
+		// Counts as initialised as soon as one instance needs cleaning up
+		initialised = true;
+	}
+	return WS2811_SUCCESS;
+}
+
+void LedOutput::fini(void)
+{
+	if (!initialised)
+		return;
+	initialised = false;
+
+	for (unsigned strip = 0; strip < OUTPUT_MAX_STRIPS; strip++) {
+		if (simulated && strip < stripCount)
+			channel(strip).leds = nullptr;
+		framebuffers[strip].clear();
+	}
+	if (simulated)
+		return;
+
+	// Instances whose init never ran, or failed, have no device
+	for (unsigned i = 0; i < instanceCount; i++)
+		if (lights[i].device)
+			ws2811_fini(&lights[i]);
+}
+
+int64_t LedOutput::wireTimeNs(unsigned instance) const
+{
+	int64_t longest = 0;
+	for (const auto &channel : lights[instance].channel) {
+		int bits = (channel.strip_type & SK6812_SHIFT_WMASK) ? 32 : 24;
+		longest = std::max(longest, (int64_t)channel.count * bits * OUTPUT_BIT_NS);
+	}
+	return longest + OUTPUT_RESET_US * 1000LL;
+}
+
+// ws2811_render only waits for the instance's previous transfer before
+// starting the next; it returns once the DMA is running. SPI has no DMA
+// there: the spidev write returns once the whole strip is out.
+ws2811_return_t LedOutput::start(unsigned instance)
+{
+	if (!simulated)
+		return ws2811_render(&lights[instance]);
+
+	int64_t now = monotonicNowNs();
+	doneNs[instance] = std::max(now, doneNs[instance]) + wireTimeNs(instance);
+	if (instancePeripheral[instance] == Spi)
+		return wait(instance);
+	return WS2811_SUCCESS;
+}
+
+ws2811_return_t LedOutput::wait(unsigned instance)
+{
+	if (!simulated)
+		return ws2811_wait(&lights[instance]);
+
+	struct timespec due;
+	due.tv_sec = doneNs[instance] / 1000000000LL;
+	due.tv_nsec = doneNs[instance] % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR)
+		;
+	return WS2811_SUCCESS;
+}
+
+ws2811_return_t LedOutput::render(void)
+{
+	ws2811_return_t result = WS2811_SUCCESS;
+
+	int64_t first = monotonicNowNs();
+	for (unsigned n = 0; n < instanceCount; n++) {
+		if (n == instanceCount - 1)
+			spreadNs = monotonicNowNs() - first;
+		ws2811_return_t status = start(startOrder[n]);
+		if (status != WS2811_SUCCESS && result == WS2811_SUCCESS)
+			result = status;
+	}
+
+	for (unsigned i = 0; i < instanceCount; i++) {
+		ws2811_return_t status = wait(i);
+		if (status != WS2811_SUCCESS && result == WS2811_SUCCESS)
+			result = status;
+	}
+	return result;
+}
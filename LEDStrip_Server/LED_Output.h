@@ -0,0 +1,107 @@
+// The LED strips, driven through as many ws2811_t instances as they need.
+//
+// The Pi has one PWM block with two channels, and rpi_ws281x can also drive
+// one strip each from PCM (GPIO 21) and SPI (GPIO 10). A strip's GPIO picks
+// its peripheral: PWM strips share one ws2811_t, PCM and SPI get one each, so
+// there are at most four strips on three instances, each instance on its own
+// DMA channel. init() refuses anything else.
+//
+// Arms are segments of a strip. Arms given the same GPIO are daisy-chained
+// on that strip in order, each starting length LEDs after the one before,
+// so more arms than peripherals share strips rather than being refused. A
+// chained strip's wire time grows with its LED count.
+//
+// render() starts every instance's transfer and only then waits for them
+// all. PWM and PCM transfers run on DMA, so those strips cost one strip's
+// wire time rather than one per instance and latch within a few
+// microseconds of each other. SPI doesn't: rpi_ws281x writes it through
+// spidev, which blocks until the whole strip is out, so the SPI strip adds
+// its wire time to render()'s start phase. It is started last, once the DMA
+// transfers are running, so that time overlaps theirs instead of delaying
+// them; a frame then costs the longer of the SPI strip and the longest DMA
+// strip.
+//
+// With simulate set nothing touches the hardware. Framebuffers are allocated
+// here, and each transfer is modelled as the wire time of the instance's
+// longest strip, blocking in the start for SPI, so frame timing can be
+// measured on any machine.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <ws2811.h>
+
+#define OUTPUT_MAX_ARMS         16
+#define OUTPUT_MAX_STRIPS       4           // PWM0, PWM1, PCM and SPI
+#define OUTPUT_MAX_INSTANCES    3           // One per peripheral
+#define OUTPUT_BIT_NS           1250        // At WS2811_TARGET_FREQ
+#define OUTPUT_RESET_US         55
+
+class LedOutput
+{
+public:
+	LedOutput();
+
+	// Setup only, before init(). One GPIO per arm, in order; with fewer GPIOs
+	// than arms, consecutive arms are dealt out evenly across them. Strips
+	// and instances are numbered in the order their GPIO and peripheral first
+	// appear, and instances take DMA channels in that order.
+	bool setLayout(unsigned arms, unsigned length);
+	void setStripType(int stripType);
+	bool setGpios(const std::vector<int> &gpios);
+	bool setDmas(const std::vector<int> &dmas);
+	void setSimulate(bool simulate) { simulated = simulate; }
+
+	ws2811_return_t init(void);
+	void fini(void);
+
+	unsigned arms(void) const { return armCount; }
+	unsigned length(void) const { return armLength; }
+	unsigned strips(void) const { return stripCount; }
+	unsigned instances(void) const { return instanceCount; }
+	bool simulate(void) const { return simulated; }
+
+	// After init().
+	ws2811_channel_t &channel(unsigned strip) { return lights[stripInstance[strip]].channel[stripChannel[strip]]; }
+	unsigned stripOf(unsigned arm) const { return armStrip[arm]; }
+	ws2811_led_t *leds(unsigned arm) { return channel(armStrip[arm]).leds + armOffset[arm]; }
+
+	// Starts every instance, SPI last, then waits for all of them. Returns the
+	// first failure, having still started and waited for the rest.
+	ws2811_return_t render(void);
+
+	// Between the first and the last instance starting, in the last render.
+	int64_t lastSpreadNs(void) const { return spreadNs; }
+
+	// Wire time of one frame on the instance, reset included.
+	int64_t wireTimeNs(unsigned instance) const;
+
+private:
+	enum Peripheral { Pwm, Pcm, Spi, PeripheralCount };
+
+	static bool peripheralOf(int gpio, Peripheral &peripheral, unsigned &pwmChannel);
+	bool assign(void);
+	ws2811_return_t start(unsigned instance);
+	ws2811_return_t wait(unsigned instance);
+
+	ws2811_t lights[OUTPUT_MAX_INSTANCES];
+	std::vector<int> gpioList;
+	int type;
+	unsigned armStrip[OUTPUT_MAX_ARMS];
+	unsigned armOffset[OUTPUT_MAX_ARMS];        // First LED on its strip
+	unsigned stripInstance[OUTPUT_MAX_STRIPS];
+	unsigned stripChannel[OUTPUT_MAX_STRIPS];
+	Peripheral instancePeripheral[OUTPUT_MAX_INSTANCES];
+	unsigned startOrder[OUTPUT_MAX_INSTANCES];
+	unsigned armCount;
+	unsigned armLength;
+	unsigned stripCount;
+	unsigned instanceCount;
+	bool simulated;
+	bool initialised;
+	int64_t spreadNs;
+
+	// Simulated backend
+	std::vector<ws2811_led_t> framebuffers[OUTPUT_MAX_STRIPS];
+	int64_t doneNs[OUTPUT_MAX_INSTANCES];
+};
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "LED_PowerLimiter.h"
+
+CurrentModel currentModelFor(int stripType)
+{
+	// SK6812 RGBW parts carry a fourth (white) die; WS281x parts three.
+	if (stripType & SK6812_SHIFT_WMASK)
+		return { 1.0f, 18.0f };
+	return { 1.0f, 20.0f };
+}
+
+PowerLimiter::PowerLimiter() :
+	stripBudget(0),
+	totalBudget(0),
+	lastEstimateMa(0),
+	rising(false),
+	stripCount(0),
+	segmentCount(0),
+	lastComputeNs(0)
+{
+}
+
+void PowerLimiter::configure(float stripBudgetMa, float totalBudgetMa)
+{
+	stripBudget = stripBudgetMa;
+	totalBudget = totalBudgetMa;
+}
+
+void PowerLimiter::setStrip(unsigned strip, CurrentModel model, uint8_t maxBrightness)
+{
+	if (strip >= POWER_MAX_STRIPS)
+		return;
+
+	models[strip] = model;
+	this->maxBrightness[strip] = maxBrightness;
+	applied[strip] = maxBrightness;
+	stripCount = std::max(stripCount, strip + 1);
+}
+
+void PowerLimiter::setSegment(unsigned segment, unsigned strip, unsigned count)
+{
+	if (segment >= POWER_MAX_SEGMENTS || strip >= POWER_MAX_STRIPS)
+		return;
+
+	units[segment] = 0;
+	counts[segment] = count;
+	segmentStrip[segment] = strip;
+	segmentCount = std::max(segmentCount, segment + 1);
+}
+
+bool PowerLimiter::compute(uint8_t brightness[], int64_t nowNs)
+{
+	float scale[POWER_MAX_STRIPS], full[POWER_MAX_STRIPS];
+	int64_t stripUnits[POWER_MAX_STRIPS] = {};
+	unsigned stripLeds[POWER_MAX_STRIPS] = {};
+	float idleMa = 0, activeMa = 0;
+	bool limited = false;
+	// Fraction of full range brightness may recover by since the last frame
+	float release = (nowNs - lastComputeNs) / (POWER_RELEASE_MS * 1e6f);
+	lastComputeNs = nowNs;
+
+	for (unsigned segment = 0; segment < segmentCount; segment++) {
+		stripUnits[segmentStrip[segment]] += units[segment];
+		stripLeds[segmentStrip[segment]] += counts[segment];
+	}
+
+	for (unsigned strip = 0; strip < stripCount; strip++) {
+		float idle = stripLeds[strip] * models[strip].idleMa;
+		// Draw above idle with every channel at the value in the framebuffer.
+		full[strip] = stripUnits[strip] * models[strip].channelMa / 255.0f;
+
+		scale[strip] = maxBrightness[strip] / 255.0f;
+		if (stripBudget > 0 && full[strip] > 0 && full[strip] * scale[strip] > stripBudget - idle)
+			scale[strip] = std::max(0.0f, (stripBudget - idle) / full[strip]);
+
+		idleMa += idle;
+		activeMa += full[strip] * scale[strip];
+	}
+
+	float factor = 1.0f;
+	if (totalBudget > 0 && idleMa + activeMa > totalBudget && activeMa > 0)
+		factor = std::max(0.0f, (totalBudget - idleMa) / activeMa);
+
+	activeMa = 0;
+	rising = false;
+	for (unsigned strip = 0; strip < stripCount; strip++) {
+		// Down straight to the cap, up by at most the release
+		float cap = std::min<float>(maxBrightness[strip], scale[strip] * factor * 255.0f);
+		applied[strip] = std::min(cap, applied[strip] + release * maxBrightness[strip]);
+		if (applied[strip] < cap)
+			rising = true;
+		brightness[strip] = applied[strip] + 0.5f;
+		if (brightness[strip] < maxBrightness[strip])
+			limited = true;
+		activeMa += full[strip] * brightness[strip] / 255.0f;
+	}
+
+	lastEstimateMa = idleMa + activeMa;
+	return limited;
+}
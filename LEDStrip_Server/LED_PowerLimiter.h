@@ -0,0 +1,95 @@
+// Keeps the estimated current draw of the strips under a budget by lowering
+// channel brightness, so full white on long arms can't brown out the BEC.
+//
+// The estimate is the sum of all channel values per segment (an arm), kept
+// up to date from the framebuffer writes themselves: update() for one LED,
+// fill() for a whole segment. Segments chained on one strip share its
+// brightness and its budget. Each frame, compute() turns the sums into
+// per-strip brightness in O(segments). Scaling brightness dims every LED by
+// the same factor, so colours keep their hue.
+//
+// Dimming is applied at once, since the budget is a hard bound, but
+// brightness comes back up no faster than full range per POWER_RELEASE_MS.
+// Content that swings around the budget (a strobe, a chase) then holds a
+// steady level instead of pumping brightness frame to frame. While ramping()
+// is true, the caller has to keep rendering (and so calling compute()) for
+// brightness to get back up, even if the framebuffer stays the same.
+#pragma once
+
+#include <cstdint>
+#include <ws2811.h>
+
+#define POWER_MAX_STRIPS        16
+#define POWER_MAX_SEGMENTS      16
+#define POWER_RELEASE_MS        500
+
+// Typical figures for 5V strips, per LED.
+struct CurrentModel
+{
+	float idleMa;               // Driver chip with all channels off
+	float channelMa;            // One channel at full brightness
+};
+
+CurrentModel currentModelFor(int stripType);
+
+class PowerLimiter
+{
+public:
+	PowerLimiter();
+
+	// Budgets in mA, 0 for no limit.
+	void configure(float stripBudgetMa, float totalBudgetMa);
+	void setStrip(unsigned strip, CurrentModel model, uint8_t maxBrightness);
+	void setSegment(unsigned segment, unsigned strip, unsigned count);
+	bool enabled(void) const { return stripBudget > 0 || totalBudget > 0; }
+
+	// One LED changed from oldColour to newColour.
+	void update(unsigned segment, ws2811_led_t oldColour, ws2811_led_t newColour)
+	{
+		units[segment] += channelSum(newColour) - channelSum(oldColour);
+	}
+
+	// Every LED of the segment set to colour.
+	void fill(unsigned segment, ws2811_led_t colour)
+	{
+		units[segment] = (int64_t)counts[segment] * channelSum(colour);
+	}
+
+	// The segment rewritten whole; channelSums is the sum of its channelSum()s.
+	void set(unsigned segment, int64_t channelSums)
+	{
+		units[segment] = channelSums;
+	}
+
+	// Writes the brightness each strip should render with at nowNs (monotonic).
+	// Returns true if any strip is dimmed below its maximum.
+	bool compute(uint8_t brightness[], int64_t nowNs);
+
+	// Estimated draw of the last computed frame, after limiting.
+	float estimateMa(void) const { return lastEstimateMa; }
+
+	// Some strip is still below what the budget allows and coming back up.
+	bool ramping(void) const { return rising; }
+
+	static int64_t channelSum(ws2811_led_t colour)
+	{
+		return (colour & 0xFF) + ((colour >> 8) & 0xFF)
+			+ ((colour >> 16) & 0xFF) + (colour >> 24);
+	}
+
+private:
+	float stripBudget;
+	float totalBudget;
+	float lastEstimateMa;
+	bool rising;
+
+	unsigned stripCount;
+	unsigned segmentCount;
+	int64_t units[POWER_MAX_SEGMENTS];      // Sum of channel values
+	unsigned counts[POWER_MAX_SEGMENTS];
+	unsigned segmentStrip[POWER_MAX_SEGMENTS];
+	CurrentModel models[POWER_MAX_STRIPS];
+	uint8_t maxBrightness[POWER_MAX_STRIPS];
+	float applied[POWER_MAX_STRIPS];        // Brightness of the last frame
+	int64_t lastComputeNs;
+};
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "LED_Scheduler.h"
+
+// std::push_heap builds a max-heap, so "greater" puts the earliest on top.
+static bool laterThan(const ScheduledCommand &a, const ScheduledCommand &b)
+{
+	if (a.dueNs != b.dueNs)
+		return a.dueNs > b.dueNs;
+	return a.order > b.order;
+}
+
+Scheduler::Scheduler() :
+	size(0),
+	timedCount(0),
+	nextOrder(0)
+{
+	heap.reserve(SCHEDULER_CAPACITY);
+
+	if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		std::cerr << "timerfd_create failed: " << strerror(errno) << '\n';
+}
+
+Scheduler::~Scheduler()
+{
+	if (timerFd >= 0)
+		close(timerFd);
+}
+
+bool Scheduler::post(const LedCommand &command, int64_t dueNs, bool timed)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (heap.size() >= SCHEDULER_CAPACITY || (timed && timedCount >= SCHEDULER_TIMED_CAPACITY))
+		return false;
+
+	uint64_t order = nextOrder++;
+	heap.push_back({ dueNs, order, timed, command });
+	if (timed)
+		timedCount++;
+	std::push_heap(heap.begin(), heap.end(), laterThan);
+	size.store(heap.size(), std::memory_order_relaxed);
+
+	// Only re-arm if this became the earliest deadline.
+	if (heap.front().order == order)
+		arm();
+
+	return true;
+}
+
+void Scheduler::acknowledge(void)
+{
+	uint64_t expirations;
+	while (read(timerFd, &expirations, sizeof(expirations)) > 0) { }
+}
+
+bool Scheduler::popDue(int64_t nowNs, ScheduledCommand &out)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (heap.empty() || heap.front().dueNs > nowNs) {
+		arm();
+		return false;
+	}
+
+	std::pop_heap(heap.begin(), heap.end(), laterThan);
+	out = heap.back();
+	heap.pop_back();
+	if (out.timed)
+		timedCount--;
+	size.store(heap.size(), std::memory_order_relaxed);
+	return true;
+}
+
+// Called with lock held. Points the timerfd at the earliest deadline.
+void Scheduler::arm(void)
+{
+	struct itimerspec spec = {};
+
+	if (!heap.empty()) {
+		// A zero it_value disarms the timer, so overdue commands get 1ns.
+		int64_t dueNs = std::max<int64_t>(heap.front().dueNs, 1);
+		spec.it_value.tv_sec = dueNs / 1000000000;
+		spec.it_value.tv_nsec = dueNs % 1000000000;
+	}
+
+	if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+		std::cerr << "timerfd_settime failed: " << strerror(errno) << '\n';
+}
@@ -0,0 +1,76 @@
+// Min-heap of LED commands keyed on a CLOCK_MONOTONIC deadline, fired from a
+// timerfd on the event loop. Commands without an execute-at time are queued
+// with a deadline of "now" so every framebuffer write happens on one thread.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+#include <ws2811.h>
+
+#define SCHEDULER_CAPACITY      256
+#define SCHEDULER_TIMED_CAPACITY 192    // The rest is kept for commands due now
+
+// Sender identity from the MAVLink header, kept for echoing back later.
+struct LedSender
+{
+	uint8_t sysid;
+	uint8_t compid;
+	uint8_t seq;
+};
+
+struct LedCommand
+{
+	enum class Kind : uint8_t {
+		StripConfig,            // LED_STRIP_CONFIG from a client
+		FlightModeColour,       // Flight mode changed; colour to show if following it
+		GaugeLevel,             // Telemetry gauge moved to a new quantized level
+	};
+
+	Kind kind;
+	ws2811_led_t flightModeColour;
+	uint16_t gaugeLevel;
+	mavlink_led_strip_config_t config;
+	LedSender sender;           // StripConfig only; echoed in status reports
+};
+
+struct ScheduledCommand
+{
+	int64_t dueNs;
+	uint64_t order;             // Keeps FIFO order between equal deadlines
+	bool timed;                 // Counts against SCHEDULER_TIMED_CAPACITY
+	LedCommand command;
+};
+
+class Scheduler
+{
+public:
+	Scheduler();
+	~Scheduler();
+
+	int fd(void) const { return timerFd; }
+
+	// Thread-safe. Returns false if the queue is full. Timed commands (with
+	// an execute-at time) can only fill SCHEDULER_TIMED_CAPACITY slots, so
+	// commands due now always find room.
+	bool post(const LedCommand &command, int64_t dueNs, bool timed = false);
+
+	// Event loop only. Acknowledge the timerfd, then call popDue until false.
+	void acknowledge(void);
+	bool popDue(int64_t nowNs, ScheduledCommand &out);
+
+	// Lock-free, for metrics.
+	size_t depth(void) const { return size.load(std::memory_order_relaxed); }
+
+private:
+	void arm(void);
+
+	std::mutex lock;
+	std::vector<ScheduledCommand> heap;
+	std::atomic<size_t> size;
+	size_t timedCount;
+	uint64_t nextOrder;
+	int timerFd;
+};
@@ -0,0 +1,99 @@
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "LED_StateFile.h"
+
+StateFile::StateFile(const std::string &path) :
+	slots(nullptr),
+	sequence(0)
+{
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, 2 * sizeof(Slot)) < 0) {
+		std::cerr << "state file: cannot open " << path << ": " << strerror(errno) << '\n';
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	void *mapping = mmap(nullptr, 2 * sizeof(Slot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		std::cerr << "state file: cannot map " << path << ": " << strerror(errno) << '\n';
+		return;
+	}
+	slots = static_cast<Slot *>(mapping);
+
+	// Carry on numbering from whatever is already there.
+	for (int i = 0; i < 2; i++)
+		if (valid(slots[i]) && slots[i].sequence > sequence)
+			sequence = slots[i].sequence;
+}
+
+StateFile::~StateFile()
+{
+	if (slots) {
+		msync(slots, 2 * sizeof(Slot), MS_SYNC);
+		munmap(slots, 2 * sizeof(Slot));
+	}
+}
+
+// FNV-1a over everything but the checksum itself.
+uint32_t StateFile::checksum(const Slot &slot)
+{
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&slot);
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < sizeof(Slot); i++) {
+		if (i >= offsetof(Slot, checksum) && i < offsetof(Slot, checksum) + sizeof(slot.checksum))
+			continue;
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+bool StateFile::valid(const Slot &slot) const
+{
+	return slot.magic == STATE_FILE_MAGIC
+		&& slot.version == STATE_FILE_VERSION
+		&& slot.size == sizeof(PersistedState)
+		&& slot.checksum == checksum(slot);
+}
+
+bool StateFile::restore(PersistedState &state) const
+{
+	if (!slots)
+		return false;
+
+	const Slot *newest = nullptr;
+	for (int i = 0; i < 2; i++)
+		if (valid(slots[i]) && (!newest || slots[i].sequence > newest->sequence))
+			newest = &slots[i];
+
+	if (!newest)
+		return false;
+	state = newest->state;
+	return true;
+}
+
+void StateFile::save(const PersistedState &state)
+{
+	if (!slots)
+		return;
+
+	// Overwrite the older slot; the newer one stays intact meanwhile.
+	Slot &slot = slots[++sequence & 1];
+	slot.magic = STATE_FILE_MAGIC;
+	slot.version = STATE_FILE_VERSION;
+	slot.size = sizeof(PersistedState);
+	slot.sequence = sequence;
+	slot.state = state;
+	slot.checksum = checksum(slot);
+
+	// Let writeback start now rather than at the next dirty-page sweep.
+	msync(slots, 2 * sizeof(Slot), MS_ASYNC);
+}
@@ -0,0 +1,54 @@
+// Last logical LED state, kept in a small mmap'd file so a restarted server
+// can show it again before MAVLink discovery has even finished.
+//
+// The file holds two checksummed slots written alternately. A crash in the
+// middle of save() can only tear the slot being written, and restore() picks
+// the newest slot that still checks out.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <ws2811.h>
+
+#define STATE_FILE_MAGIC        0x5344454C      // "LEDS"
+#define STATE_FILE_VERSION      1
+
+struct PersistedState
+{
+	uint8_t followingFlightMode;
+	uint8_t reserved;
+	uint16_t gaugeLevel;
+	ws2811_led_t manualColour;
+	ws2811_led_t flightModeColour;
+};
+
+class StateFile
+{
+public:
+	explicit StateFile(const std::string &path);
+	~StateFile();
+
+	bool ok(void) const { return slots != nullptr; }
+
+	// False if neither slot holds a valid state of this version.
+	bool restore(PersistedState &state) const;
+
+	// Cheap enough to call on every change: a memcpy into the mapping.
+	void save(const PersistedState &state);
+
+private:
+	struct Slot {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t size;
+		uint32_t sequence;
+		uint32_t checksum;
+		PersistedState state;
+	};
+
+	static uint32_t checksum(const Slot &slot);
+	bool valid(const Slot &slot) const;
+
+	Slot *slots;                // Two of them
+	uint32_t sequence;
+};
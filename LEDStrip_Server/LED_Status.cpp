@@ -0,0 +1,86 @@
+#include <cstring>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "LED_Metrics.h"
+#include "LED_Status.h"
+
+using namespace mavsdk;
+
+StatusPublisher::StatusPublisher(double maxRateHz) :
+	latest{},
+	sent{},
+	message{},
+	intervalNs(maxRateHz > 0 ? (int64_t)(1e9 / maxRateHz) : 0),
+	lastSentNs(0),
+	haveSent(false),
+	pending(false)
+{
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+StatusPublisher::~StatusPublisher()
+{
+	if (timerFd >= 0)
+		close(timerFd);
+}
+
+void StatusPublisher::addLink(MavlinkPassthrough &passthrough)
+{
+	links.push_back(&passthrough);
+}
+
+void StatusPublisher::update(const mavlink_led_strip_config_t &status, int64_t nowNs)
+{
+	latest = status;
+
+	// MAVLink payload structs are packed, so memcmp sees only real fields.
+	if (haveSent && !memcmp(&latest, &sent, sizeof(latest))) {
+		pending = false;
+		return;
+	}
+
+	if (!haveSent || nowNs - lastSentNs >= intervalNs) {
+		send(nowNs);
+		return;
+	}
+
+	// Too soon; the timer sends whatever is latest by then.
+	if (!pending) {
+		pending = true;
+		arm(lastSentNs + intervalNs);
+	}
+}
+
+void StatusPublisher::expire(int64_t nowNs)
+{
+	uint64_t expirations;
+	if (read(timerFd, &expirations, sizeof(expirations)) <= 0)
+		return;
+
+	if (pending)
+		send(nowNs);
+}
+
+void StatusPublisher::send(int64_t nowNs)
+{
+	pending = false;
+	haveSent = true;
+	lastSentNs = nowNs;
+	sent = latest;
+
+	for (auto *link : links) {
+		mavlink_msg_led_strip_config_encode(link->get_our_sysid(), link->get_our_compid(),
+				&message, &sent);
+		link->send_message(message);
+	}
+	metrics.statusReports.add();
+}
+
+void StatusPublisher::arm(int64_t dueNs)
+{
+	struct itimerspec spec = {};
+	spec.it_value.tv_sec = dueNs / 1000000000;
+	spec.it_value.tv_nsec = dueNs % 1000000000;
+	timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
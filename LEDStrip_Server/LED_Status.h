@@ -0,0 +1,47 @@
+// Compact status reports: what the LEDs are showing and the last command
+// applied, sent back as an LED_STRIP_CONFIG marked with LED_STATUS_STRIP_ID
+// (see LEDStrip_Common/LEDStrip_Protocol.h for the slot layout).
+//
+// Reports go out only when their content changes, and no faster than the
+// configured rate. A change inside the interval arms a timerfd that sends
+// the latest content when it expires, so a burst of commands ends in exactly
+// one report carrying the final state. The message is encoded into a buffer
+// owned by the publisher; nothing allocates per report.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#define STATUS_DEFAULT_RATE_HZ  5.0
+
+class StatusPublisher
+{
+public:
+	explicit StatusPublisher(double maxRateHz);
+	~StatusPublisher();
+
+	bool ok(void) const { return timerFd >= 0; }
+	int fd(void) const { return timerFd; }
+
+	// Setup only. Reports are sent on every link added.
+	void addLink(mavsdk::MavlinkPassthrough &passthrough);
+
+	// Event loop only.
+	void update(const mavlink_led_strip_config_t &status, int64_t nowNs);
+	void expire(int64_t nowNs);     // timerfd handler
+
+private:
+	void send(int64_t nowNs);
+	void arm(int64_t dueNs);
+
+	std::vector<mavsdk::MavlinkPassthrough *> links;
+	mavlink_led_strip_config_t latest;
+	mavlink_led_strip_config_t sent;
+	mavlink_message_t message;
+	int64_t intervalNs;
+	int64_t lastSentNs;
+	bool haveSent;
+	bool pending;
+	int timerFd;
+};
@@ -0,0 +1,135 @@
+#include <ctime>
+#include <limits>
+
+#include "LED_EventLoop.h"
+#include "LED_TimeSync.h"
+
+using namespace mavsdk;
+
+// Round trips slower than this say more about the link than about the clocks.
+#define TIMESYNC_MAX_RTT_NS     (250 * 1000000LL)
+
+static int64_t realtimeMinusMonotonicNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	int64_t realtimeNs = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return realtimeNs - monotonicNowNs();
+}
+
+TimeSync::TimeSync() :
+	sampleCount(0),
+	nextSample(0),
+	outstandingTs1(0),
+	unixSampleCount(0),
+	nextUnixSample(0),
+	sharedMinusLocalNs(realtimeMinusMonotonicNs()),
+	lastRtt(0),
+	autopilotSynced(false)
+{
+}
+
+void TimeSync::request(MavlinkPassthrough &mavlink_passthrough)
+{
+	mavlink_message_t message;
+	mavlink_timesync_t timesync = {};
+
+	timesync.tc1 = 0;
+	timesync.ts1 = monotonicNowNs();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		outstandingTs1 = timesync.ts1;
+		// Keep following CLOCK_REALTIME until the autopilot answers.
+		if (!synced())
+			publish();
+	}
+
+	mavlink_msg_timesync_encode(
+		mavlink_passthrough.get_our_sysid(),
+		mavlink_passthrough.get_our_compid(),
+		&message,
+		&timesync);
+
+	mavlink_passthrough.send_message(message);
+}
+
+void TimeSync::handleTimesync(const mavlink_message_t &msg)
+{
+	int64_t now = monotonicNowNs();
+	mavlink_timesync_t timesync;
+	mavlink_msg_timesync_decode(&msg, &timesync);
+
+	// tc1 == 0 is somebody else's request; MAVSDK answers those.
+	if (timesync.tc1 == 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (timesync.ts1 != outstandingTs1)
+		return;
+	outstandingTs1 = 0;
+
+	int64_t rtt = now - timesync.ts1;
+	if (rtt < 0 || rtt > TIMESYNC_MAX_RTT_NS)
+		return;
+
+	// Assume the reply was stamped halfway through the round trip.
+	samples[nextSample] = { timesync.tc1 - (timesync.ts1 + rtt / 2), rtt };
+	nextSample = (nextSample + 1) % TIMESYNC_SAMPLES;
+	if (sampleCount < TIMESYNC_SAMPLES)
+		sampleCount++;
+
+	lastRtt.store(rtt, std::memory_order_relaxed);
+	publish();
+}
+
+void TimeSync::handleSystemTime(const mavlink_message_t &msg)
+{
+	mavlink_system_time_t system_time;
+	mavlink_msg_system_time_decode(&msg, &system_time);
+
+	// No GPS/RTC on the autopilot yet.
+	if (system_time.time_unix_usec == 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	unixMinusBootNs[nextUnixSample] = (int64_t)system_time.time_unix_usec * 1000
+	                                - (int64_t)system_time.time_boot_ms * 1000000;
+	nextUnixSample = (nextUnixSample + 1) % TIMESYNC_SAMPLES;
+	if (unixSampleCount < TIMESYNC_SAMPLES)
+		unixSampleCount++;
+
+	publish();
+}
+
+// Called with lock held.
+void TimeSync::publish(void)
+{
+	if (sampleCount == 0 || unixSampleCount == 0) {
+		sharedMinusLocalNs.store(realtimeMinusMonotonicNs(), std::memory_order_relaxed);
+		return;
+	}
+
+	// The quickest round trip has the least asymmetric delay in it.
+	const Sample *best = &samples[0];
+	for (unsigned i = 1; i < sampleCount; i++)
+		if (samples[i].rttNs < best->rttNs)
+			best = &samples[i];
+
+	int64_t unixMinusBoot = std::numeric_limits<int64_t>::max();
+	for (unsigned i = 0; i < unixSampleCount; i++)
+		if (unixMinusBootNs[i] < unixMinusBoot)
+			unixMinusBoot = unixMinusBootNs[i];
+
+	sharedMinusLocalNs.store(unixMinusBoot + best->offsetNs, std::memory_order_relaxed);
+	autopilotSynced.store(true, std::memory_order_relaxed);
+}
+
+int64_t TimeSync::sharedToLocalNs(uint64_t sharedUs) const
+{
+	return (int64_t)sharedUs * 1000 - sharedMinusLocalNs.load(std::memory_order_relaxed);
+}
+
+uint64_t TimeSync::localToSharedUs(int64_t localNs) const
+{
+	return (uint64_t)((localNs + sharedMinusLocalNs.load(std::memory_order_relaxed)) / 1000);
+}
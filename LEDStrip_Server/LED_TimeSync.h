@@ -0,0 +1,58 @@
+// Estimates the offset between our CLOCK_MONOTONIC and the shared timebase
+// (Unix time as seen by the autopilot) so execute-at timestamps can be
+// turned into local deadlines.
+//
+// Two measurements are combined:
+// - TIMESYNC round trips give autopilot boot clock - our monotonic clock.
+// - SYSTEM_TIME gives autopilot Unix time - autopilot boot clock.
+// Without SYSTEM_TIME (no GPS) we fall back to our own CLOCK_REALTIME.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#define TIMESYNC_SAMPLES        8
+
+class TimeSync
+{
+public:
+	TimeSync();
+
+	// Send a TIMESYNC request. Call periodically (around 1Hz).
+	void request(mavsdk::MavlinkPassthrough &mavlink_passthrough);
+
+	void handleTimesync(const mavlink_message_t &msg);
+	void handleSystemTime(const mavlink_message_t &msg);
+
+	// Shared time (Unix us) <-> CLOCK_MONOTONIC ns. Lock-free.
+	int64_t sharedToLocalNs(uint64_t sharedUs) const;
+	uint64_t localToSharedUs(int64_t localNs) const;
+
+	bool synced(void) const { return autopilotSynced.load(std::memory_order_relaxed); }
+	int64_t lastRttNs(void) const { return lastRtt.load(std::memory_order_relaxed); }
+
+private:
+	void publish(void);
+
+	struct Sample {
+		int64_t offsetNs;       // autopilot boot clock - local monotonic
+		int64_t rttNs;
+	};
+
+	std::mutex lock;
+	Sample samples[TIMESYNC_SAMPLES];
+	unsigned sampleCount;
+	unsigned nextSample;
+	int64_t outstandingTs1;
+	// autopilot Unix time - autopilot boot clock. time_boot_ms is truncated,
+	// so the smallest value seen in the window is the closest to the truth.
+	int64_t unixMinusBootNs[TIMESYNC_SAMPLES];
+	unsigned unixSampleCount;
+	unsigned nextUnixSample;
+
+	std::atomic<int64_t> sharedMinusLocalNs;
+	std::atomic<int64_t> lastRtt;
+	std::atomic<bool> autopilotSynced;
+};
@@ -0,0 +1,75 @@
+// Two stand-in sources sending conflicting commands as fast as they can: a
+// companion override (priority 1, red) that runs for a while and then goes
+// quiet, and the GCS (priority 0, green) that never stops. The override must
+// win while it is live and the GCS must take over once it has gone stale.
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "LED_Arbiter.h"
+#include "LED_EventLoop.h"
+
+#define STALE_NS                20000000LL      // 20 ms
+#define OVERRIDE_NS             200000000LL     // How long the override sends
+#define RUN_NS                  400000000LL
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+int main(void)
+{
+	Arbiter arbiter;
+	int gcs = arbiter.addSource(0, STALE_NS);
+	int companion = arbiter.addSource(1, STALE_NS);
+	CHECK(gcs == 0 && companion == 1);
+
+	std::atomic<int64_t> companionFirstNs(0), companionLastNs(0);
+	std::atomic<bool> companionDone(false);
+	uint64_t companionSent = 0, companionApplied = 0;
+	uint64_t gcsSent = 0, gcsDuringOverride = 0, gcsAfterStale = 0;
+	int64_t start = monotonicNowNs();
+
+	std::thread override([&]() {
+		int64_t now;
+		while ((now = monotonicNowNs()) - start < OVERRIDE_NS) {
+			if (!companionFirstNs.load(std::memory_order_relaxed))
+				companionFirstNs.store(now, std::memory_order_relaxed);
+			companionSent++;
+			companionApplied += arbiter.accept(companion, now);
+			companionLastNs.store(now, std::memory_order_relaxed);
+		}
+		companionDone.store(true);
+	});
+
+	std::thread ground([&]() {
+		int64_t now;
+		while ((now = monotonicNowNs()) - start < RUN_NS) {
+			bool applied = arbiter.accept(gcs, now);
+			gcsSent++;
+
+			// Leave a millisecond either side for the threads' clocks to settle.
+			int64_t first = companionFirstNs.load(std::memory_order_relaxed);
+			int64_t last = companionLastNs.load(std::memory_order_relaxed);
+			if (applied && first && now > first + 1000000 && !companionDone.load())
+				gcsDuringOverride++;
+			if (applied && companionDone.load() && now > last + STALE_NS + 1000000)
+				gcsAfterStale++;
+		}
+	});
+
+	override.join();
+	ground.join();
+
+	std::printf("companion: %llu sent, %llu applied; gcs: %llu sent, %llu applied during override, %llu after\n",
+			(unsigned long long)companionSent, (unsigned long long)companionApplied,
+			(unsigned long long)gcsSent, (unsigned long long)gcsDuringOverride,
+			(unsigned long long)gcsAfterStale);
+
+	CHECK(companionSent > 1000);
+	CHECK(companionApplied == companionSent);
+	CHECK(gcsDuringOverride == 0);
+	CHECK(gcsAfterStale > 1000);
+
+	return failures ? 1 : 0;
+}
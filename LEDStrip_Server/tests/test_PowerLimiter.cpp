@@ -0,0 +1,84 @@
+// A heavy frame followed by a lighter one that then stays unchanged: the
+// limiter must dim at once, report ramping() until it is back at what the
+// budget allows, and get there within POWER_RELEASE_MS of renders driven
+// only by a timer, as the server's power ramp timer does. Arms chained on one
+// strip are limited as that strip.
+#include <cstdio>
+
+#include "LED_PowerLimiter.h"
+
+#define LEDS                    60
+#define FRAME_NS                20000000LL      // POWER_RAMP_RATE_HZ in the server
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// Brightness the budget allows for colour, with nothing to recover from.
+static uint8_t capFor(ws2811_led_t colour)
+{
+	PowerLimiter limiter;
+	uint8_t brightness[1];
+	limiter.configure(1000, 0);
+	limiter.setStrip(0, { 1.0f, 20.0f }, 255);
+	limiter.setSegment(0, 0, LEDS);
+	limiter.fill(0, colour);
+	limiter.compute(brightness, 0);
+	return brightness[0];
+}
+
+int main(void)
+{
+	PowerLimiter limiter;
+	uint8_t brightness[1];
+	int64_t now = 1000000000LL;
+	uint8_t whiteCap = capFor(0xFFFFFF), greyCap = capFor(0x808080);
+
+	limiter.configure(1000, 0);
+	limiter.setStrip(0, { 1.0f, 20.0f }, 255);
+	limiter.setSegment(0, 0, LEDS);
+
+	// Full white dims straight to its cap.
+	limiter.fill(0, 0xFFFFFF);
+	CHECK(limiter.compute(brightness, now));
+	CHECK(brightness[0] == whiteCap);
+	CHECK(!limiter.ramping());
+
+	// A lighter frame 100 ms later is allowed more, but only gets part way.
+	now += 100000000LL;
+	limiter.fill(0, 0x808080);
+	limiter.compute(brightness, now);
+	std::printf("white cap %u, grey cap %u, grey after 100 ms %u\n", whiteCap, greyCap, brightness[0]);
+	CHECK(brightness[0] > whiteCap && brightness[0] < greyCap);
+	CHECK(limiter.ramping());
+
+	// Nothing changes from here on; only the ramp timer renders.
+	int renders = 0;
+	while (limiter.ramping() && renders < 1000) {
+		now += FRAME_NS;
+		limiter.compute(brightness, now);
+		renders++;
+	}
+	std::printf("grey reached %u after %d timer renders\n", brightness[0], renders);
+	CHECK(brightness[0] == greyCap);
+	CHECK(renders * FRAME_NS <= POWER_RELEASE_MS * 1000000LL);
+
+	// Settled: another render changes nothing and asks for no more.
+	now += FRAME_NS;
+	limiter.compute(brightness, now);
+	CHECK(brightness[0] == greyCap);
+	CHECK(!limiter.ramping());
+
+	// Two arms chained on one strip share its budget and its brightness.
+	PowerLimiter chained;
+	chained.configure(1000, 0);
+	chained.setStrip(0, { 1.0f, 20.0f }, 255);
+	chained.setSegment(0, 0, LEDS / 2);
+	chained.setSegment(1, 0, LEDS / 2);
+	chained.fill(0, 0xFFFFFF);
+	chained.fill(1, 0xFFFFFF);
+	chained.compute(brightness, now);
+	CHECK(brightness[0] == whiteCap);
+
+	return failures ? 1 : 0;
+}